@@ -287,6 +287,21 @@ GeneticVSTComposerJUCEAudioProcessorEditor::
 
   currentHeight += 35;
 
+  //--- Progress of the generation
+  progressLbl.setBounds(25, currentHeight, getWidth() - 50, 20);
+  progressLbl.setJustificationType(juce::Justification::centred);
+  addAndMakeVisible(progressLbl);
+
+  currentHeight += 25;
+
+  //--- Cost of processBlock on the audio thread
+  audioStatsLbl.setBounds(25, currentHeight, getWidth() - 50, 45);
+  audioStatsLbl.setFont(juce::Font(12.0f));
+  audioStatsLbl.setJustificationType(juce::Justification::topLeft);
+  addAndMakeVisible(audioStatsLbl);
+
+  currentHeight += 50;
+
   //--- DEBUG label
   int debugWidth = getWidth() - 50;
   debugTextBox.setBounds((getWidth() - debugWidth) / 2, currentHeight,
@@ -299,22 +314,40 @@ GeneticVSTComposerJUCEAudioProcessorEditor::
   // adding Listeners
   scaleSnapBtn.addListener(this);
   startGenBtn.addListener(this);
+  diversitySlid.addListener(this);
+  dynamicsSlid.addListener(this);
+  arousalSlid.addListener(this);
+  valenceSlid.addListener(this);
+  pauseAmountSlid.addListener(this);
+  jazzinessSlid.addListener(this);
+  weirdnessSlid.addListener(this);
+
+  startTimerHz(10);
 }
 
 GeneticVSTComposerJUCEAudioProcessorEditor::
     ~GeneticVSTComposerJUCEAudioProcessorEditor() {
+  stopTimer();
   // removing Listeners
   scaleSnapBtn.removeListener(this);
   startGenBtn.removeListener(this);
+  diversitySlid.removeListener(this);
+  dynamicsSlid.removeListener(this);
+  arousalSlid.removeListener(this);
+  valenceSlid.removeListener(this);
+  pauseAmountSlid.removeListener(this);
+  jazzinessSlid.removeListener(this);
+  weirdnessSlid.removeListener(this);
 }
 
 void GeneticVSTComposerJUCEAudioProcessorEditor::buttonClicked(
     juce::Button *button) {
   if (button == &startGenBtn) // Start Generation Button clicked
   {
-    int speedQualityNO =
-        speedQualitySlid.getValue(); // index for values of population size and
-                                     // generation number
+    // population size and generation number (speed <--> quality),
+    // calibrated for this machine by the processor
+    PresetCalibration::Preset preset =
+        audioProcessor.getSpeedQualityPreset(speedQualitySlid.getValue());
     int composeMode = -1;
     if (mode0Btn.getToggleState())
       composeMode = 0;
@@ -344,8 +377,8 @@ void GeneticVSTComposerJUCEAudioProcessorEditor::buttonClicked(
         weirdnessSlid.getValue(),              // weirdness
         noteDurationValues[noteDurationBox.getSelectedId() -
                            1],                     // note duration
-        SpeedQualityValues[speedQualityNO].first,  // population size
-        SpeedQualityValues[speedQualityNO].second, // generation number
+        preset.populationSize,                     // population size
+        preset.numGenerations,                     // generation number
         seqLenBox.getText().getDoubleValue());     // sequence length
   } else if (button = &scaleSnapBtn) // when he scale button gets toggled
   {
@@ -353,6 +386,75 @@ void GeneticVSTComposerJUCEAudioProcessorEditor::buttonClicked(
   }
 }
 
+void GeneticVSTComposerJUCEAudioProcessorEditor::sliderValueChanged(
+    juce::Slider *slider) {
+  // Fitness sliders rerank the last population live, before the next
+  // "Generate!"
+  audioProcessor.RerankMelodies(diversitySlid.getValue(),   // diversity
+                                dynamicsSlid.getValue(),    // dynamics
+                                arousalSlid.getValue(),     // arousal
+                                pauseAmountSlid.getValue(), // pause amount
+                                valenceSlid.getValue(),     // valence
+                                jazzinessSlid.getValue(),   // jazziness
+                                weirdnessSlid.getValue());  // weirdness
+  repaint();
+}
+
+void GeneticVSTComposerJUCEAudioProcessorEditor::timerCallback() {
+  if (audioProcessor.isGenerating()) {
+    GeneticMelodyGenerator::Progress progress =
+        audioProcessor.getGenerationProgress();
+    progressLbl.setText(
+        "Generation " + juce::String(progress.generation) + "/" +
+            juce::String(progress.generations) + " - best " +
+            juce::String(progress.bestFitness, 2) + ", average " +
+            juce::String(progress.averageFitness, 2),
+        juce::dontSendNotification);
+  } else {
+    progressLbl.setText({}, juce::dontSendNotification);
+  }
+
+  // new melodies or a rerank
+  int revision = audioProcessor.getDebugInfoRevision();
+  if (revision != shownDebugRevision) {
+    shownDebugRevision = revision;
+    debugTextBox.setText(audioProcessor.getDebugInfo(), false);
+  }
+
+  if (++statsTicks == STATS_TICKS) {
+    statsTicks = 0;
+    updateAudioStats();
+  }
+}
+
+void GeneticVSTComposerJUCEAudioProcessorEditor::updateAudioStats() {
+  AudioStats::Snapshot stats = audioProcessor.readAudioStats();
+  AudioStats::Snapshot window = stats.since(lastStats);
+  lastStats = stats;
+
+  auto percent = [](double load) { return juce::String(load * 100.0, 1); };
+  juce::String text =
+      "Audio load " + percent(window.averageLoad()) + "%, peak " +
+      percent(window.peakLoad) + "%, worst " + percent(stats.worstLoad) +
+      "%, overruns " + juce::String((juce::uint64)stats.overruns) + "\n";
+  double eventsPerBlock =
+      window.blocks > 0 ? double(window.events) / window.blocks : 0.0;
+  text += "Events per block " + juce::String(eventsPerBlock, 2) + ", max " +
+          juce::String(window.maxEvents) + "\n";
+  // share of the blocks per bucket, by the upper edge of its load
+  text += "Load <=";
+  for (int i = 0; i < AudioStats::BUCKETS; ++i) {
+    juce::String edge = i < AudioStats::BUCKETS - 1
+                            ? percent(AudioStats::BUCKET_EDGES[i]) + "%"
+                            : juce::String("over");
+    double share = window.blocks > 0
+                       ? 100.0 * window.histogram[i] / window.blocks
+                       : 0.0;
+    text += " " + edge + ": " + juce::String(share, 0) + "%";
+  }
+  audioStatsLbl.setText(text, juce::dontSendNotification);
+}
+
 //==============================================================================
 void GeneticVSTComposerJUCEAudioProcessorEditor::paint(juce::Graphics &g) {
   // (Our component is opaque, so we must completely fill the background with a
@@ -362,9 +464,6 @@ void GeneticVSTComposerJUCEAudioProcessorEditor::paint(juce::Graphics &g) {
 
   g.setColour(juce::Colours::white);
   g.setFont(15.0f);
-
-  // updating the debug text (its update'ed in the real-time)
-  debugTextBox.setText(audioProcessor.debugInfo, false);
 }
 
 void GeneticVSTComposerJUCEAudioProcessorEditor::resized() {
@@ -16,7 +16,9 @@
  */
 class GeneticVSTComposerJUCEAudioProcessorEditor
     : public juce::AudioProcessorEditor,
-      public juce::Button::Listener {
+      public juce::Button::Listener,
+      public juce::Slider::Listener,
+      private juce::Timer {
 public:
   GeneticVSTComposerJUCEAudioProcessorEditor(
       GeneticVSTComposerJUCEAudioProcessor &);
@@ -34,18 +36,24 @@ private:
   GeneticVSTComposerJUCEAudioProcessor &audioProcessor;
 
   void buttonClicked(juce::Button *button) override;
+  void sliderValueChanged(juce::Slider *slider) override;
+  // Polls the progress of the generation running in the background
+  void timerCallback() override;
+  int shownDebugRevision = -1;
+  // The audio-thread stats are shown over windows of this many timer ticks
+  static const int STATS_TICKS = 5;
+  int statsTicks = 0;
+  AudioStats::Snapshot lastStats;
+  void updateAudioStats();
 
   int modeRadioGroupID = 56789;
-  std::pair<int, int> SpeedQualityValues[3] = {
-      {64, 50},
-      {128, 100},
-      {256, 200}}; // populations, generations (speed <--> quality)
   juce::StringArray noteDurationStr = {"1/8", "1/16", "1/32"};
   float noteDurationValues[4] = {0.5, 0.25, 0.125};
 
   int counter = 1;
 
   juce::TextButton startGenBtn;
+  juce::Label progressLbl;
 
   // data GUIs
   juce::TextButton mode0Btn; // 0 - Full melody
@@ -85,6 +93,7 @@ private:
   juce::Label separationLabel;
 
   // debug label
+  juce::Label audioStatsLbl;
   juce::TextEditor debugTextBox;
 
   JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(
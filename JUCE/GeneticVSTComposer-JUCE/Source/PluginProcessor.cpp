@@ -8,6 +8,8 @@
 
 #include "PluginProcessor.h"
 #include "PluginEditor.h"
+#include <chrono>
+#include <fstream>
 
 //==============================================================================
 GeneticVSTComposerJUCEAudioProcessor::GeneticVSTComposerJUCEAudioProcessor()
@@ -23,9 +25,15 @@ GeneticVSTComposerJUCEAudioProcessor::GeneticVSTComposerJUCEAudioProcessor()
       )
 #endif
 {
+  velocityRandom = XorShift32(std::random_device()());
+  selectedMelody.forEach(
+      [](std::vector<int> &buffer) { buffer.reserve(MAX_MELODY_STEPS); });
 }
 
-GeneticVSTComposerJUCEAudioProcessor::~GeneticVSTComposerJUCEAudioProcessor() {}
+GeneticVSTComposerJUCEAudioProcessor::~GeneticVSTComposerJUCEAudioProcessor() {
+  // the running generation uses the generator and the melodies
+  generationPool.removeAllJobs(true, 10000);
+}
 
 //==============================================================================
 const juce::String GeneticVSTComposerJUCEAudioProcessor::getName() const {
@@ -83,6 +91,11 @@ void GeneticVSTComposerJUCEAudioProcessor::prepareToPlay(double sampleRate,
                                                          int samplesPerBlock) {
   // Use this method as the place to do any pre-playback
   // initialisation that you need..
+  // processBlock must not allocate: selecting a melody copies it into
+  // reserved space and the MIDI output reuses its buffer
+  melody.reserve(MAX_MELODY_STEPS);
+  player.prepare(MAX_MELODY_STEPS);
+  processedMidi.ensureSize(MIDI_BUFFER_BYTES);
 }
 
 void GeneticVSTComposerJUCEAudioProcessor::releaseResources() {
@@ -154,8 +167,8 @@ static juce::String getMidiMessageDescription(const juce::MidiMessage &m) {
   return juce::String::toHexString(m.getRawData(), m.getRawDataSize());
 }
 
-int snapNoteToScale(int targetNote) {
-  std::vector<int> notes(NotesGenerator::g_scale_notes);
+int snapNoteToScale(int targetNote, const std::vector<int> &scaleNotes) {
+  std::vector<int> notes(scaleNotes);
   std::sort(notes.begin(), notes.end());
   if (notes.empty()) {
     return targetNote;
@@ -179,29 +192,53 @@ void GeneticVSTComposerJUCEAudioProcessor::processBlock(
     juce::AudioBuffer<float> &buffer, juce::MidiBuffer &midiMessages) {
   jassert(buffer.getNumChannels() ==
           0); // It's a MIDI plugin, no audio data should be processed.
+  // Counts allocations in test builds, see allocation_guard.hpp
+  const AllocationGuard::AudioThreadScope audioThread;
+  TRACE_SCOPE("processBlock");
+  const auto blockStarted = std::chrono::steady_clock::now();
 
   const int numSamples = buffer.getNumSamples();
-  juce::MidiBuffer processedMidi;
+  processedMidi.clear();
+
+  // Adopt the latest melodies. The playing melody is a copy and goes on.
+  melodySets.update();
+  const MelodySet &melodySet = melodySets.read();
 
-  // Obtain the playhead from the host to fetch current BPM
+  // Obtain the playhead from the host to fetch current BPM and position
   juce::AudioPlayHead *playHead = getPlayHead();
   juce::AudioPlayHead::CurrentPositionInfo playHeadInfo;
+  PlaybackClock::HostPosition host;
 
   if (playHead && playHead->getCurrentPosition(playHeadInfo)) {
-    // Calculate the duration of a note based on the current BPM
-    double beatsPerSecond = playHeadInfo.bpm / 60.0;
-    double secondsPerBeat = 1.0 / beatsPerSecond;
-    double secondsPerNote = secondsPerBeat * fundNoteDuration;
-    samplesBetweenNotes = static_cast<int>(secondsPerNote * getSampleRate());
-
-    int newNumerator = playHeadInfo.timeSigNumerator;
-    int newDenominator = playHeadInfo.timeSigDenominator;
-
-    meter.first = newNumerator;
-    meter.second = newDenominator;
+    host.valid = true;
+    host.playing = playHeadInfo.isPlaying;
+    host.ppq = playHeadInfo.ppqPosition;
+    host.bpm = playHeadInfo.bpm;
+    host.barStart = playHeadInfo.ppqPositionOfLastBarStart;
+    host.numerator = playHeadInfo.timeSigNumerator;
+    host.denominator = playHeadInfo.timeSigDenominator;
+
+    meterNumerator = playHeadInfo.timeSigNumerator;
+    meterDenominator = playHeadInfo.timeSigDenominator;
+  }
 
-    adjustMelodyForMeter();
+  auto sendNoteOff = [this](int sample, int pitch) {
+    processedMidi.addEvent(juce::MidiMessage::noteOff(1, pitch), sample);
+  };
+
+  switch (clock.advance(host, numSamples, getSampleRate())) {
+  case PlaybackClock::JUMP:
+    // the sounding note ends, the melody goes on where it would be now
+    player.flush(0, sendNoteOff);
+    player.seek(clock.position());
+    break;
+  case PlaybackClock::RETIMED:
+    player.rebase(clock.offset());
+    break;
+  default:
+    break;
   }
+  const double samplesPerPpq = clock.samplesPerPpq();
 
   for (const auto &metadata : midiMessages) {
     const auto message = metadata.getMessage();
@@ -211,12 +248,15 @@ void GeneticVSTComposerJUCEAudioProcessor::processBlock(
       int noteNumber = message.getNoteNumber();
       if (noteNumber >= 48 && noteNumber < 60) {
         int melodyIndex = noteNumber - 48;
-        if (melodyIndex < melodies.size()) {
-          melody = melodies[melodyIndex];
-          originalMelody = melody; // Store the original melody
-          melodyTemplate = melody; // Store the template
-          currentNoteIndex = 0;    // Restart the sequence
-          nextNoteTime = time;     // Start now
+        if (melodyIndex < melodySet.melodies.size()) {
+          melody = melodySet.melodies[melodyIndex];
+          selectedMelody.write() = melody; // Store the template
+          selectedMelody.publish();
+          // Restart the sequence now, ending the sounding note
+          player.flush(time, sendNoteOff);
+          player.start(melodySet.schedules[melodyIndex],
+                       clock.quantize(clock.position() + time / samplesPerPpq,
+                                      startQuantization));
           isSequencePlaying = true;
           initialVelocity = message.getVelocity();
         }
@@ -232,6 +272,8 @@ void GeneticVSTComposerJUCEAudioProcessor::processBlock(
                  message.getNoteNumber() < 60) {
         if (isSequencePlaying) {
           isSequencePlaying = false;
+          player.stop();
+          player.flush(time, sendNoteOff);
           processedMidi.addEvent(juce::MidiMessage::allNotesOff(1),
                                  time); // Stop all notes to avoid hanging notes
         }
@@ -239,65 +281,149 @@ void GeneticVSTComposerJUCEAudioProcessor::processBlock(
     }
   }
 
-  if (isSequencePlaying && !melody.empty()) {
-      int noteDuration = samplesBetweenNotes;
-      while (nextNoteTime < numSamples && isSequencePlaying) {
-          if (currentNoteIndex < melody.size()) {
-              const int note = melody[currentNoteIndex];
-              if (note >= 0) {
-                  int transposedNote = note + transposition;
-                  if (scaleSnapping) // apply snapping if enabled
-                      transposedNote = snapNoteToScale(transposedNote);
-
-                  std::random_device rd;
-                  std::mt19937 gen(rd());
-                  std::uniform_int_distribution<> dis(initialVelocity - 5, initialVelocity + 5);
-                  int velocity = dis(gen);
-                  velocity = std::clamp(velocity, 0, 127);
-
-                  // Add MIDI Note-On for note
-                  processedMidi.addEvent(juce::MidiMessage::noteOn(
-                                            1, transposedNote, (juce::uint8)velocity),
-                                            nextNoteTime);
-
-                  // Calculate note duration using extensions (-2) 
-                  noteDuration = samplesBetweenNotes;
-                  int tempIndex = currentNoteIndex;
-                  while (tempIndex + 1 < melody.size() && melody[tempIndex + 1] == -2) {
-                      noteDuration += samplesBetweenNotes;
-                      tempIndex++;
-                  }
-
-                  // Add note-off after calculated end of note
-                  processedMidi.addEvent(juce::MidiMessage::noteOff(1, transposedNote),
-                                         nextNoteTime + noteDuration - 1);
-                  lastNote = transposedNote;
-
-                  nextNoteTime += noteDuration;
-                  currentNoteIndex = tempIndex;
-              }
-              else if (note == -1) {
-                  
-                  lastNote = -1;
-                  nextNoteTime += samplesBetweenNotes;
-              }
-              else if (note == -2) {
-                  nextNoteTime += samplesBetweenNotes;
-                  if (lastNote != -1) {
-                      continue;
-                  }
-              }
-
-              currentNoteIndex = (currentNoteIndex + 1) % melody.size();
-          }
-          else {
-              break; // Break the loop if index is out of range
-          }
-      }
+  // Only the notes starting or ending in this block are touched
+  player.render(
+      clock.position(), samplesPerPpq, numSamples,
+      [&](int sample, int pitch) {
+        int transposedNote = std::clamp(pitch + transposition, 0, 127);
+        if (scaleSnapping) // apply snapping if enabled
+          transposedNote = melodySet.snapTable[transposedNote];
+
+        int velocity =
+            velocityRandom.uniform(initialVelocity - 5, initialVelocity + 5);
+        velocity = std::clamp(velocity, 0, 127);
+
+        // Add MIDI Note-On for note, its note-off comes from the player
+        processedMidi.addEvent(
+            juce::MidiMessage::noteOn(1, transposedNote, (juce::uint8)velocity),
+            sample);
+        return transposedNote;
+      },
+      sendNoteOff);
+
+  // Copied rather than swapped, so the reserved buffer stays ours
+  midiMessages.clear();
+  midiMessages.addEvents(processedMidi, 0, -1, 0);
+
+  const std::chrono::duration<double> busy =
+      std::chrono::steady_clock::now() - blockStarted;
+  audioStats.record(busy.count(), numSamples / getSampleRate(),
+                    processedMidi.getNumEvents());
+}
+
+// Runs one GenerateMelody request on the generation thread
+class GeneticVSTComposerJUCEAudioProcessor::GenerationJob
+    : public juce::ThreadPoolJob {
+public:
+  GenerationJob(GeneticVSTComposerJUCEAudioProcessor &processor,
+                GenerationRequest request)
+      : juce::ThreadPoolJob("Melody generation"), processor(processor),
+        request(std::move(request)) {}
+  // Queued jobs removed by a newer click are deleted without running
+  ~GenerationJob() override { processor.pendingGenerations--; }
+
+  JobStatus runJob() override {
+    Trace::setThreadName("Melody generation");
+    processor.sharedPresets->runningGenerations++;
+    if (!shouldExit())
+      processor.runGeneration(request, [this] { return shouldExit(); });
+    processor.sharedPresets->runningGenerations--;
+    // a calibration this generation stopped starts over
+    processor.sharedPresets->resume(processor.runOptions());
+    // a newer click has started its own capture
+    if (Trace::ENABLED && !shouldExit())
+      processor.writeTrace();
+    return jobHasFinished;
   }
-  // Adjust for the next block
-  nextNoteTime -= numSamples;
-  midiMessages.swapWith(processedMidi);
+
+private:
+  GeneticVSTComposerJUCEAudioProcessor &processor;
+  GenerationRequest request;
+};
+
+// Times the generator on this machine for the speed/quality presets
+class GeneticVSTComposerJUCEAudioProcessor::SharedPresets::CalibrationJob
+    : public juce::ThreadPoolJob {
+public:
+  CalibrationJob(SharedPresets &presets, const RunOptions &options)
+      : juce::ThreadPoolJob("Preset calibration"), presets(presets),
+        options(options) {}
+
+  JobStatus runJob() override {
+    bool finished = presets.calibrate(options, [this] {
+      return shouldExit() || presets.runningGenerations > 0;
+    });
+    presets.queued = false;
+    // A generation that stopped the calibration may have called resume()
+    // before this job cleared queued. Then no generation runs any more by
+    // now, and the job queues itself again; otherwise the last generation
+    // to finish does.
+    if (!finished && !shouldExit() && presets.runningGenerations == 0)
+      presets.resume(options);
+    return jobHasFinished;
+  }
+
+private:
+  SharedPresets &presets;
+  RunOptions options;
+};
+
+std::atomic<bool>
+    GeneticVSTComposerJUCEAudioProcessor::presetCalibrationEnabled{true};
+
+void GeneticVSTComposerJUCEAudioProcessor::setPresetCalibration(bool enabled) {
+  presetCalibrationEnabled = enabled;
+}
+
+GeneticVSTComposerJUCEAudioProcessor::SharedPresets::~SharedPresets() {
+  pool.removeAllJobs(true, 10000);
+}
+
+void GeneticVSTComposerJUCEAudioProcessor::SharedPresets::request(
+    const RunOptions &options) {
+  requested = true;
+  resume(options);
+}
+
+void GeneticVSTComposerJUCEAudioProcessor::SharedPresets::resume(
+    const RunOptions &options) {
+  if (!requested || !presetCalibrationEnabled || calibrated ||
+      queued.exchange(true))
+    return;
+  pool.addJob(new CalibrationJob(*this, options), true);
+}
+
+bool GeneticVSTComposerJUCEAudioProcessor::SharedPresets::calibrate(
+    const RunOptions &options, const std::function<bool()> &shouldStop) {
+  // the editor's default settings, with the options of a real run
+  GeneticMelodyGenerator::Parameters params;
+  params.noteDuration = 0.25f;
+  std::vector<PresetCalibration::Preset> calibratedPresets =
+      PresetCalibration::calibrate(
+          params, 1.0f,
+          std::vector<double>(PRESET_LATENCIES.begin(),
+                              PRESET_LATENCIES.end()),
+          [&](GeneticMelodyGenerator &generator) {
+            applyRunOptions(generator, params, options);
+            generator.set_cancellation_check(shouldStop);
+          },
+          shouldStop);
+  if (calibratedPresets.size() != presets.size() || shouldStop())
+    return false;
+  for (size_t i = 0; i < presets.size(); ++i)
+    presets[i] = calibratedPresets[i];
+  calibrated = true;
+  return true;
+}
+
+PresetCalibration::Preset
+GeneticVSTComposerJUCEAudioProcessor::SharedPresets::get(int index) const {
+  return presets[juce::jlimit(0, 2, index)];
+}
+
+PresetCalibration::Preset
+GeneticVSTComposerJUCEAudioProcessor::getSpeedQualityPreset(int index) const {
+  return sharedPresets->get(index);
 }
 
 void GeneticVSTComposerJUCEAudioProcessor::GenerateMelody(
@@ -305,19 +431,165 @@ void GeneticVSTComposerJUCEAudioProcessor::GenerateMelody(
     float diversity, float dynamics, float arousal, float pauseAmount,
     float valence, float jazziness, float weirdness, float noteDuration,
     int populationSize, int numGenerations, float sequenceLength) {
-  fundNoteDuration = noteDuration;
-  NotesGenerator generator_nut = NotesGenerator(scale);
-  std::vector<int> scale_notes = NotesGenerator(scale).generateNotes(1, 0);
-  NotesGenerator::g_scale_notes = scale_notes;
+  Trace::start();
+  Trace::setThreadName("Message thread");
+  TRACE_SCOPE("GenerateMelody");
+  GenerationRequest request;
+  GeneticMelodyGenerator::Parameters &params = request.params;
+  params.mode = composeMode;
+  params.scale = scale;
+  params.noteRange = noteRange;
+  params.diversity = diversity;
+  params.dynamics = dynamics;
+  params.arousal = arousal;
+  params.pauseAmount = pauseAmount;
+  params.valence = valence;
+  params.jazziness = jazziness;
+  params.weirdness = weirdness;
+  params.meter = {meterNumerator.load(), meterDenominator.load()};
+  params.noteDuration = noteDuration;
+  params.populationSize = populationSize;
+  params.numGenerations = numGenerations;
+  request.sequenceLength = sequenceLength;
+  selectedMelody.update();
+  request.melodyTemplate = selectedMelody.read();
+
+  // A new click supersedes the running generation: it is cancelled at the
+  // next generation and the queued ones are dropped
+  generationPool.removeAllJobs(true, 0);
+  generationProgress = GeneticMelodyGenerator::Progress{};
+  pendingGenerations++;
+  generationPool.addJob(new GenerationJob(*this, std::move(request)), true);
+}
+
+void GeneticVSTComposerJUCEAudioProcessor::runGeneration(
+    const GenerationRequest &request,
+    const GeneticMelodyGenerator::CancellationCheck &shouldStop) {
+  TRACE_SCOPE("runGeneration");
+  const GeneticMelodyGenerator::Parameters &params = request.params;
+  const juce::ScopedLock lock(generatorLock);
+  GeneratorSettings settings{params.mode,           params.scale,
+                             params.noteRange,      params.meter,
+                             params.noteDuration,   params.populationSize,
+                             params.numGenerations, request.sequenceLength,
+                             request.melodyTemplate};
+
+  if (generator == nullptr) {
+    generator = std::make_unique<GeneticMelodyGenerator>(params);
+  } else if (warmStart && generator->has_cached_population() &&
+             settings == generatorSettings) {
+    // Only the sliders changed - continue from the last population, best
+    // melodies for the new sliders first
+    generator->configure(params);
+    generator->seed_population(generator->rerank(params.populationSize),
+                               warmStartFreshFraction,
+                               warmStartGenerationFraction);
+  } else {
+    // The generator is reused, only what changed is recomputed
+    generator->configure(params);
+    generator->reset();
+  }
+
   // run the genetic algorithm
-  GeneticMelodyGenerator generator(
-      composeMode, scale, noteRange, diversity, dynamics, arousal, pauseAmount,
-      valence, jazziness, weirdness, meter, fundNoteDuration, populationSize,
-      numGenerations);
+  applyRunOptions(*generator, params, runOptions());
+  generator->set_progress_callback(
+      [this, &shouldStop](const GeneticMelodyGenerator::Progress &progress) {
+        if (!shouldStop())
+          generationProgress = progress;
+      });
+  generator->set_cancellation_check(shouldStop);
+  std::vector<std::vector<int>> result =
+      generator->run(request.sequenceLength, request.melodyTemplate);
+  generator->set_progress_callback(nullptr);
+  generator->set_cancellation_check(nullptr);
+  if (result.empty())
+    return; // superseded or nothing to generate, the last melodies stay
+
+  generatorSettings = settings;
+  melodies = std::move(result);
+  publishMelodies(params.noteDuration, params.scale);
+  updateDebugInfo();
+}
 
-  melodies = generator.run(sequenceLength, melodyTemplate);
+void GeneticVSTComposerJUCEAudioProcessor::writeTrace() const {
+  Trace::stop();
+  const juce::File file =
+      juce::File::getSpecialLocation(juce::File::tempDirectory)
+          .getChildFile(TRACE_FILE_NAME);
+  std::ofstream out(file.getFullPathName().toStdString());
+  const size_t events = Trace::write(out);
+  DBG("Trace: " << (int)events << " events (" << (juce::int64)Trace::dropped()
+                << " dropped) in " << file.getFullPathName());
+}
+
+GeneticVSTComposerJUCEAudioProcessor::RunOptions
+GeneticVSTComposerJUCEAudioProcessor::runOptions() const {
+  return {localSearchBudgetMs, adaptiveOperators, scaleRepairMaxJazziness};
+}
 
-  debugInfo = "Generated Melodies:\n";
+void GeneticVSTComposerJUCEAudioProcessor::applyRunOptions(
+    GeneticMelodyGenerator &generator,
+    const GeneticMelodyGenerator::Parameters &params,
+    const RunOptions &options) {
+  generator.set_local_search(options.localSearchBudgetMs);
+  generator.set_adaptive_operators(options.adaptiveOperators);
+  GeneticMelodyGenerator::RepairOptions repairOptions;
+  repairOptions.snapToScale =
+      params.jazziness <= options.scaleRepairMaxJazziness;
+  repairOptions.leadingExtension = true;
+  repairOptions.noteRange = true;
+  generator.set_repair(repairOptions);
+}
+
+void GeneticVSTComposerJUCEAudioProcessor::publishMelodies(
+    float noteDuration, const std::string &scale) {
+  // The back buffer keeps the capacity of an older set, nothing is freed on
+  // the audio thread
+  MelodySet &melodySet = melodySets.write();
+  melodySet.melodies = melodies;
+  // a step lasts noteDuration of a quarter note
+  melodySet.schedules.clear();
+  for (const auto &melody : melodies)
+    melodySet.schedules.push_back(
+        MelodySchedule::compile(melody, noteDuration));
+  if (scale != snapScale) {
+    std::vector<int> scaleNotes = NotesGenerator(scale).generateNotes(1, 0);
+    for (int note = 0; note < 128; ++note)
+      snapTable[note] = static_cast<juce::uint8>(
+          std::clamp(snapNoteToScale(note, scaleNotes), 0, 127));
+    snapScale = scale;
+  }
+  melodySet.snapTable = snapTable;
+  melodySets.publish();
+}
+
+bool GeneticVSTComposerJUCEAudioProcessor::isGenerating() const {
+  return pendingGenerations > 0;
+}
+
+GeneticMelodyGenerator::Progress
+GeneticVSTComposerJUCEAudioProcessor::getGenerationProgress() const {
+  return generationProgress;
+}
+
+void GeneticVSTComposerJUCEAudioProcessor::RerankMelodies(
+    float diversity, float dynamics, float arousal, float pauseAmount,
+    float valence, float jazziness, float weirdness) {
+  // Skipped while a generation is running, its melodies replace these anyway
+  const juce::ScopedTryLock lock(generatorLock);
+  if (!lock.isLocked() || generator == nullptr ||
+      !generator->has_cached_population())
+    return;
+
+  generator->set_parameters(diversity, dynamics, arousal, pauseAmount,
+                            valence, jazziness, weirdness);
+  melodies = generator->rerank();
+  publishMelodies(generatorSettings.noteDuration, generatorSettings.scale);
+  updateDebugInfo();
+}
+
+void GeneticVSTComposerJUCEAudioProcessor::updateDebugInfo() {
+  std::string debugInfo = "Generated Melodies:\n";
   int melodyCount = 0;
   for (const auto &melody : melodies) {
     debugInfo += "Melody " + std::to_string(++melodyCount) + ": ";
@@ -327,6 +599,33 @@ void GeneticVSTComposerJUCEAudioProcessor::GenerateMelody(
     debugInfo +=
         "\n"; // Append a newline after each melody for better readability
   }
+
+  if (generator != nullptr) {
+    // applications / improvements (rate) of every operator in the last run
+    debugInfo += "Operators:\n";
+    for (const auto &stats : generator->operator_stats()) {
+      debugInfo += stats.name + ": " + std::to_string(stats.applications) +
+                   " / " + std::to_string(stats.improvements) + " (" +
+                   juce::String(stats.rate, 2).toStdString() + ")\n";
+    }
+  }
+
+  const juce::ScopedLock lock(debugInfoLock);
+  this->debugInfo = std::move(debugInfo);
+  debugInfoRevision++;
+}
+
+std::string GeneticVSTComposerJUCEAudioProcessor::getDebugInfo() const {
+  const juce::ScopedLock lock(debugInfoLock);
+  return debugInfo;
+}
+
+int GeneticVSTComposerJUCEAudioProcessor::getDebugInfoRevision() const {
+  return debugInfoRevision;
+}
+
+AudioStats::Snapshot GeneticVSTComposerJUCEAudioProcessor::readAudioStats() {
+  return audioStats.read();
 }
 
 //==============================================================================
@@ -336,6 +635,8 @@ bool GeneticVSTComposerJUCEAudioProcessor::hasEditor() const {
 
 juce::AudioProcessorEditor *
 GeneticVSTComposerJUCEAudioProcessor::createEditor() {
+  // DAW scans and harnesses never open the editor, so they don't calibrate
+  sharedPresets->request(runOptions());
   return new GeneticVSTComposerJUCEAudioProcessorEditor(*this);
 }
 
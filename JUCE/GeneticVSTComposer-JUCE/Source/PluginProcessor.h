@@ -8,8 +8,14 @@
 
 #pragma once
 
+#include "allocation_guard.hpp"
+#include "audio_stats.hpp"
 #include "genetic.hpp"
+#include "melody_player.hpp"
 #include "notes_generator.hpp"
+#include "preset_calibration.hpp"
+#include "trace.hpp"
+#include "triple_buffer.hpp"
 #include <JuceHeader.h>
 
 //==============================================================================
@@ -33,19 +39,57 @@ public:
 
   //          CUSTOM
   // Method to generate melody and save it in the processor using Genetic
-  // Algorithms
+  // Algorithms. It runs on the generation thread and returns immediately; a
+  // generation still running is cancelled.
   void GenerateMelody(int composeMode, std::string scale,
                       std::pair<int, int> noteRange, float diversity,
                       float dynamics, float arousal, float pauseAmount,
                       float valence, float jazziness, float weirdness,
                       float noteDuration, int populationSize,
                       int numGenerations, float sequenceLength);
-  std::vector<int> originalMelody;
+  // Method to rescore the last generated population with new slider values,
+  // without running the Genetic Algorithm again
+  void RerankMelodies(float diversity, float dynamics, float arousal,
+                      float pauseAmount, float valence, float jazziness,
+                      float weirdness);
+  // Playing melody, owned by the audio thread
   std::vector<int> melody;
-  std::vector<int> melodyTemplate;
+  // Last generated melodies, owned by the thread generating or reranking
+  // them. The audio thread plays their published copy.
   std::vector<std::vector<int>> melodies;
-  bool scaleSnapping = false;
-  std::string debugInfo;
+  std::atomic<bool> scaleSnapping{false}; // read by the audio thread
+  // A triggered melody starts on the next beat or bar instead of at once
+  std::atomic<PlaybackClock::Quantization> startQuantization{
+      PlaybackClock::NO_QUANTIZATION};
+  // Warm start from the last population when only the fitness sliders changed
+  bool warmStart = true;
+  float warmStartFreshFraction = 0.25f;      // random individuals in the seed
+  float warmStartGenerationFraction = 0.25f; // generations of a warm run
+  // Time for the local search polishing each returned melody (0 - off)
+  float localSearchBudgetMs = 20.0f;
+  // Adapt the mutation and crossover rates while evolving
+  bool adaptiveOperators = true;
+  // Repair of out-of-scale notes is used below this jazziness, where the
+  // scale conformance target is (almost) 1
+  float scaleRepairMaxJazziness = 0.1f;
+  // Population size and generations of the speed/quality presets of the
+  // editor, calibrated in the background for these latencies (seconds).
+  // The calibration runs once per process, after the first editor opens, and
+  // all instances share it.
+  static constexpr std::array<double, 3> PRESET_LATENCIES = {0.1, 0.5, 2.0};
+  PresetCalibration::Preset getSpeedQualityPreset(int index) const;
+  // Harnesses turn the calibration off so it doesn't compete with what they
+  // measure. The presets then keep their defaults.
+  static void setPresetCalibration(bool enabled);
+  // Progress of the running generation, for the editor
+  bool isGenerating() const;
+  GeneticMelodyGenerator::Progress getGenerationProgress() const;
+  // Text of the debug box. The revision changes whenever the text does.
+  std::string getDebugInfo() const;
+  int getDebugInfoRevision() const;
+  // Cost of processBlock so far. Starts a new window for the peaks, so only
+  // one reader (the editor) should poll it.
+  AudioStats::Snapshot readAudioStats();
 
   //==============================================================================
   juce::AudioProcessorEditor *createEditor() override;
@@ -75,46 +119,141 @@ private:
   JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(
       GeneticVSTComposerJUCEAudioProcessor)
   juce::AudioPlayHead::CurrentPositionInfo lastPosInfo;
-  std::vector<std::pair<int, int>>
-      noteOffTimes; // To track note offs outside the current block
-  std::array<int, 16> notes{60, 61, 62, -2, -2, -2, 65, -1,
-                            66, 68, -1, 61, 62, 63, 70, 80};
-  int currentNoteIndex = 0;
-  int nextNoteTime = 0;
-  std::vector<int> g_scale_notes;
-  std::pair<int, int> meter{4, 4};
-  int samplesBetweenNotes = 48000;
+  // Plays the selected melody, its note-offs may fall into later blocks
+  MelodyPlayer player;
+  // Follows the host's ppq, also through tempo changes, loops and jumps
+  PlaybackClock clock;
+  // Output of processBlock, reserved in prepareToPlay
+  juce::MidiBuffer processedMidi;
+  static const int MIDI_BUFFER_BYTES = 16384;
+  // Spread of the note velocities, seeded once
+  XorShift32 velocityRandom;
+  // Time signature of the host, written by the audio thread
+  std::atomic<int> meterNumerator{4};
+  std::atomic<int> meterDenominator{4};
   bool isSequencePlaying = false;
   int activeNotesCount = 0; // Track how many keys are pressed
-  int lastNote = -1;
   int selectedMelodyIndex = -1;
   int transposition = 0;
   int initialVelocity;
   int composeMode = 0;
-  float fundNoteDuration = 0.25;
-
-  void adjustMelodyForMeter() {
-    if (originalMelody.empty())
-      return;
-
-    // Calculate the number of notes in the melody for one measure
-    int currentMeasureLength = meter.first * 4 / meter.second;
-    int newMeasureLength = meter.first * 4 / meter.second;
-
-    // Adjust melody length
-    std::vector<int> newMelody;
-    if (newMeasureLength < currentMeasureLength) {
-      // Cut the melody to fit the new meter
-      for (int i = 0; i < newMeasureLength; ++i) {
-        newMelody.push_back(originalMelody[i % originalMelody.size()]);
-      }
-    } else {
-      // Extend the melody to fit the new meter
-      newMelody = originalMelody;
-      for (int i = originalMelody.size(); i < newMeasureLength; ++i) {
-        newMelody.push_back(originalMelody[i % originalMelody.size()]);
-      }
+  // Generator of all melodies, created on the first click and reconfigured
+  // afterwards. Its last population is kept for reranking.
+  std::unique_ptr<GeneticMelodyGenerator> generator;
+  // Settings of the last run. While they stay the same, its final
+  // population can seed the next run.
+  struct GeneratorSettings {
+    int composeMode;
+    std::string scale;
+    std::pair<int, int> noteRange;
+    std::pair<int, int> meter;
+    float noteDuration;
+    int populationSize;
+    int numGenerations;
+    float sequenceLength;
+    std::vector<int> melodyTemplate;
+
+    bool operator==(const GeneratorSettings &other) const {
+      return composeMode == other.composeMode && scale == other.scale &&
+             noteRange == other.noteRange && meter == other.meter &&
+             noteDuration == other.noteDuration &&
+             populationSize == other.populationSize &&
+             numGenerations == other.numGenerations &&
+             sequenceLength == other.sequenceLength &&
+             (composeMode != 2 || melodyTemplate == other.melodyTemplate);
     }
-    melody = newMelody;
-  }
+  } generatorSettings;
+
+  // Melodies as handed to the audio thread, with what is needed to play them
+  struct MelodySet {
+    std::vector<std::vector<int>> melodies;
+    std::vector<MelodySchedule> schedules; // one per melody
+    // Every MIDI note snapped to the nearest note of the scale
+    std::array<juce::uint8, 128> snapTable;
+  };
+  // Steps (and notes) reserved for the playing melody, so selecting one
+  // doesn't allocate
+  static const int MAX_MELODY_STEPS = 1024;
+  // Written under generatorLock, read by processBlock
+  TripleBuffer<MelodySet> melodySets;
+  void publishMelodies(float noteDuration, const std::string &scale);
+  // Snap table of the last published scale, only rebuilt when it changes
+  std::string snapScale;
+  std::array<juce::uint8, 128> snapTable;
+  // Melody selected on the keyboard, written by processBlock and read as the
+  // template of the next generation
+  TripleBuffer<std::vector<int>> selectedMelody;
+
+  void updateDebugInfo();
+  mutable juce::CriticalSection debugInfoLock;
+  std::string debugInfo;
+  std::atomic<int> debugInfoRevision{0};
+  // Written at the end of every processBlock
+  AudioStats audioStats;
+
+  // Arguments of one GenerateMelody call
+  struct GenerationRequest {
+    GeneticMelodyGenerator::Parameters params;
+    float sequenceLength;
+    std::vector<int> melodyTemplate;
+  };
+  class GenerationJob;
+  void
+  runGeneration(const GenerationRequest &request,
+                const GeneticMelodyGenerator::CancellationCheck &shouldStop);
+  // Local search, operator control and repair of a run. Copied, so that the
+  // calibration doesn't depend on the instance that queued it.
+  struct RunOptions {
+    float localSearchBudgetMs;
+    bool adaptiveOperators;
+    float scaleRepairMaxJazziness;
+  };
+  RunOptions runOptions() const;
+  static void applyRunOptions(GeneticMelodyGenerator &generator,
+                              const GeneticMelodyGenerator::Parameters &params,
+                              const RunOptions &options);
+  // Guards the generator while it runs or reranks
+  juce::CriticalSection generatorLock;
+  std::atomic<int> pendingGenerations{0};
+  std::atomic<GeneticMelodyGenerator::Progress> generationProgress{
+      GeneticMelodyGenerator::Progress{}};
+  // Speed/quality presets of every instance in the process, calibrated on
+  // their own thread. Until the calibration finishes, they stay at the
+  // defaults.
+  class SharedPresets {
+  public:
+    ~SharedPresets();
+    PresetCalibration::Preset get(int index) const;
+    // Queues the calibration, unless it is done, queued or turned off
+    void request(const RunOptions &options);
+    // Generations running in any instance. The calibration stops for them
+    // and resume() queues it again after them, if it was requested.
+    std::atomic<int> runningGenerations{0};
+    void resume(const RunOptions &options);
+
+  private:
+    class CalibrationJob;
+    // Returns false when stopped
+    bool calibrate(const RunOptions &options,
+                   const std::function<bool()> &shouldStop);
+    std::array<std::atomic<PresetCalibration::Preset>, 3> presets{
+        {PresetCalibration::Preset{64, 50},
+         PresetCalibration::Preset{128, 100},
+         PresetCalibration::Preset{256, 200}}};
+    std::atomic<bool> requested{false};
+    std::atomic<bool> calibrated{false};
+    std::atomic<bool> queued{false};
+    juce::ThreadPool pool{1};
+  };
+  juce::SharedResourcePointer<SharedPresets> sharedPresets;
+  static std::atomic<bool> presetCalibrationEnabled;
+  // Trace builds: every click captures the spans until its melodies are
+  // published, written to TRACE_FILE_NAME in the temporary directory
+  static constexpr const char *TRACE_FILE_NAME =
+      "GeneticVSTComposer-trace.json";
+  void writeTrace() const;
+  // One generation at a time. Declared last, so its job is stopped before
+  // the members it uses are destroyed.
+  juce::ThreadPool generationPool{1};
+
 };
@@ -0,0 +1,166 @@
+#include "allocation_guard.hpp"
+
+#ifdef DETECT_AUDIO_ALLOCATIONS
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#if defined(__GLIBC__)
+#include <execinfo.h>
+#include <unistd.h>
+// glibc's own allocator, under the replaced malloc
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *pointer, size_t size);
+#elif defined(_WIN32)
+#include <intrin.h>
+#include <malloc.h>
+#endif
+
+namespace {
+
+std::atomic<uint64_t> allocations{0};
+std::atomic<bool> trapping{false};
+// Plain thread-locals, they are used from within the allocator
+thread_local int audioThreadDepth = 0;
+thread_local bool reporting = false;
+
+void noteAllocation(size_t size) {
+  if (audioThreadDepth == 0 || reporting)
+    return;
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (!trapping.load(std::memory_order_relaxed))
+    return;
+
+  reporting = true; // printing may allocate itself
+  std::fprintf(stderr, "Allocation of %zu bytes on the audio thread\n", size);
+#if defined(__GLIBC__)
+  void *frames[64];
+  int depth = backtrace(frames, 64);
+  backtrace_symbols_fd(frames, depth, STDERR_FILENO);
+  std::abort();
+#elif defined(_WIN32)
+  __debugbreak(); // the debugger shows the stack
+#else
+  std::abort();
+#endif
+}
+
+void *allocate(size_t size) {
+  noteAllocation(size);
+#if defined(__GLIBC__)
+  return __libc_malloc(size ? size : 1);
+#else
+  return std::malloc(size ? size : 1);
+#endif
+}
+
+void *allocateAligned(size_t size, std::align_val_t alignment) {
+  noteAllocation(size);
+  size_t align = static_cast<size_t>(alignment);
+#if defined(_WIN32)
+  return _aligned_malloc(size ? size : 1, align);
+#else
+  void *pointer = nullptr;
+  if (posix_memalign(&pointer, align < sizeof(void *) ? sizeof(void *) : align,
+                     size ? size : 1) != 0)
+    return nullptr;
+  return pointer;
+#endif
+}
+
+void freeAligned(void *pointer) {
+#if defined(_WIN32)
+  _aligned_free(pointer);
+#else
+  std::free(pointer);
+#endif
+}
+
+} // namespace
+
+namespace AllocationGuard {
+
+uint64_t count() { return allocations.load(std::memory_order_relaxed); }
+
+void setTrap(bool trap) { trapping.store(trap, std::memory_order_relaxed); }
+
+AudioThreadScope::AudioThreadScope() { audioThreadDepth++; }
+
+AudioThreadScope::~AudioThreadScope() { audioThreadDepth--; }
+
+} // namespace AllocationGuard
+
+// Replacements of the global allocation functions
+void *operator new(size_t size) {
+  if (void *pointer = allocate(size))
+    return pointer;
+  throw std::bad_alloc();
+}
+void *operator new[](size_t size) { return operator new(size); }
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  return allocate(size);
+}
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+  return allocate(size);
+}
+void *operator new(size_t size, std::align_val_t alignment) {
+  if (void *pointer = allocateAligned(size, alignment))
+    return pointer;
+  throw std::bad_alloc();
+}
+void *operator new[](size_t size, std::align_val_t alignment) {
+  return operator new(size, alignment);
+}
+void *operator new(size_t size, std::align_val_t alignment,
+                   const std::nothrow_t &) noexcept {
+  return allocateAligned(size, alignment);
+}
+void *operator new[](size_t size, std::align_val_t alignment,
+                     const std::nothrow_t &) noexcept {
+  return allocateAligned(size, alignment);
+}
+
+void operator delete(void *pointer) noexcept { std::free(pointer); }
+void operator delete[](void *pointer) noexcept { std::free(pointer); }
+void operator delete(void *pointer, size_t) noexcept { std::free(pointer); }
+void operator delete[](void *pointer, size_t) noexcept { std::free(pointer); }
+void operator delete(void *pointer, const std::nothrow_t &) noexcept {
+  std::free(pointer);
+}
+void operator delete[](void *pointer, const std::nothrow_t &) noexcept {
+  std::free(pointer);
+}
+void operator delete(void *pointer, std::align_val_t) noexcept {
+  freeAligned(pointer);
+}
+void operator delete[](void *pointer, std::align_val_t) noexcept {
+  freeAligned(pointer);
+}
+void operator delete(void *pointer, size_t, std::align_val_t) noexcept {
+  freeAligned(pointer);
+}
+void operator delete[](void *pointer, size_t, std::align_val_t) noexcept {
+  freeAligned(pointer);
+}
+
+#if defined(__GLIBC__)
+// C allocations too, e.g. by libraries. With other C libraries only operator
+// new is covered.
+extern "C" void *malloc(size_t size) {
+  noteAllocation(size);
+  return __libc_malloc(size);
+}
+extern "C" void *calloc(size_t count, size_t size) {
+  noteAllocation(count * size);
+  return __libc_calloc(count, size);
+}
+extern "C" void *realloc(void *pointer, size_t size) {
+  noteAllocation(size);
+  return __libc_realloc(pointer, size);
+}
+#endif
+
+#endif // DETECT_AUDIO_ALLOCATIONS
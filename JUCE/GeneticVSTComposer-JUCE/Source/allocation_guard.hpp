@@ -0,0 +1,45 @@
+#ifndef ALLOCATION_GUARD_HPP
+#define ALLOCATION_GUARD_HPP
+
+#include <cstdint>
+
+// Detects heap allocations on the audio thread in test builds. With
+// DETECT_AUDIO_ALLOCATIONS defined, allocation_guard.cpp replaces the global
+// operator new (and malloc, calloc and realloc with glibc) and counts every
+// allocation made while a thread is inside an AudioThreadScope. Otherwise
+// all of this compiles to nothing.
+namespace AllocationGuard {
+
+#ifdef DETECT_AUDIO_ALLOCATIONS
+
+// Allocations on the audio thread so far, over all threads
+uint64_t count();
+// Aborts with a stack trace on the next allocation on the audio thread,
+// instead of only counting it
+void setTrap(bool trap);
+
+// Marks the current thread as the audio thread for its lifetime. Scopes may
+// nest.
+class AudioThreadScope {
+public:
+  AudioThreadScope();
+  ~AudioThreadScope();
+  AudioThreadScope(const AudioThreadScope &) = delete;
+  AudioThreadScope &operator=(const AudioThreadScope &) = delete;
+};
+
+#else
+
+inline uint64_t count() { return 0; }
+inline void setTrap(bool) {}
+
+class AudioThreadScope {
+public:
+  AudioThreadScope() {}
+};
+
+#endif
+
+} // namespace AllocationGuard
+
+#endif // ALLOCATION_GUARD_HPP
@@ -0,0 +1,153 @@
+// Built by CMakeLists.txt (target allocation_test, with GENETIC_JUCE_DIR
+// set) with DETECT_AUDIO_ALLOCATIONS defined, and run by ctest.
+// ./allocation_test [--trap]
+//
+// Drives the processor like a host and a user would: generate, trigger a
+// melody, transpose it, rerank and generate again while it plays, loop the
+// host, stop. Fails if processBlock allocated at any point; with --trap it
+// aborts with the stack of the first allocation instead.
+
+#include "PluginProcessor.h"
+#include "allocation_guard.hpp"
+#include <JuceHeader.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#ifndef DETECT_AUDIO_ALLOCATIONS
+#error "allocation_test.cpp needs DETECT_AUDIO_ALLOCATIONS"
+#endif
+
+// Host transport, moved on by the test after every block
+class TestPlayHead : public juce::AudioPlayHead {
+public:
+  double ppq = 0.0;
+  double bpm = 120.0;
+  bool playing = true;
+
+#if JUCE_MAJOR_VERSION >= 7
+  juce::Optional<PositionInfo> getPosition() const override {
+    PositionInfo info;
+    info.setIsPlaying(playing);
+    info.setPpqPosition(ppq);
+    info.setBpm(bpm);
+    info.setPpqPositionOfLastBarStart(std::floor(ppq / 4.0) * 4.0);
+    info.setTimeSignature(TimeSignature{4, 4});
+    return info;
+  }
+#else
+  bool getCurrentPosition(CurrentPositionInfo &info) override {
+    info.resetToDefault();
+    info.isPlaying = playing;
+    info.ppqPosition = ppq;
+    info.bpm = bpm;
+    info.ppqPositionOfLastBarStart = std::floor(ppq / 4.0) * 4.0;
+    info.timeSigNumerator = 4;
+    info.timeSigDenominator = 4;
+    return true;
+  }
+#endif
+};
+
+// Input of one block: a key pressed or released at a sample
+struct KeyEvent {
+  int block;
+  int sample;
+  int note;
+  bool pressed;
+};
+
+const double SAMPLE_RATE = 48000.0;
+const int MAX_BLOCK_SIZE = 4096;
+
+void generate(GeneticVSTComposerJUCEAudioProcessor &processor) {
+  processor.GenerateMelody(0, "C Major", {60, 72}, 0.5f, 0.5f, 0.5f, 0.5f,
+                           0.5f, 0.5f, 0.5f, 0.25f, 64, 50, 2.0f);
+}
+
+bool waitForGeneration(GeneticVSTComposerJUCEAudioProcessor &processor) {
+  for (int i = 0; i < 6000 && processor.isGenerating(); ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  return !processor.isGenerating();
+}
+
+int main(int argc, char **argv) {
+  juce::ScopedJuceInitialiser_GUI juceInitialiser;
+  if (argc > 1 && std::strcmp(argv[1], "--trap") == 0)
+    AllocationGuard::setTrap(true);
+
+  // the calibration would run next to what is measured
+  GeneticVSTComposerJUCEAudioProcessor::setPresetCalibration(false);
+  GeneticVSTComposerJUCEAudioProcessor processor;
+  TestPlayHead playHead;
+  processor.setPlayHead(&playHead);
+  processor.prepareToPlay(SAMPLE_RATE, MAX_BLOCK_SIZE);
+
+  generate(processor);
+  if (!waitForGeneration(processor)) {
+    std::printf("the generation didn't finish\n");
+    return 1;
+  }
+
+  const KeyEvent keys[] = {
+      {10, 100, 48, true},  // trigger the first melody
+      {40, 0, 62, true},    // transpose by two
+      {70, 31, 62, false},  // and back
+      {100, 5, 49, true},   // the second melody takes over
+      {130, 7, 48, false},  // releasing a melody key stops playback
+      {160, 0, 50, true},   // trigger the third melody
+      {400, 77, 50, false}, // stop
+  };
+
+  juce::AudioBuffer<float> buffer;
+  juce::MidiBuffer midi;
+  midi.ensureSize(16384);
+  juce::Random random(2024);
+  uint64_t before = AllocationGuard::count();
+  int notes = 0;
+
+  for (int block = 0; block < 500; ++block) {
+    // rerank and regenerate while the melody plays
+    if (block == 200)
+      processor.RerankMelodies(0.9f, 0.1f, 0.9f, 0.1f, 0.9f, 0.1f, 0.9f);
+    if (block == 250)
+      generate(processor);
+    // the host loops back
+    if (block == 300)
+      playHead.ppq = 4.0;
+
+    int numSamples = 16 << random.nextInt(9); // 16 - 4096
+    buffer.setSize(0, numSamples, false, false, true);
+    midi.clear();
+    for (const KeyEvent &key : keys) {
+      if (key.block != block)
+        continue;
+      int sample = std::min(key.sample, numSamples - 1);
+      midi.addEvent(key.pressed ? juce::MidiMessage::noteOn(1, key.note,
+                                                            (juce::uint8)100)
+                                : juce::MidiMessage::noteOff(1, key.note),
+                    sample);
+    }
+
+    processor.processBlock(buffer, midi);
+
+    for (const auto &metadata : midi)
+      if (metadata.getMessage().isNoteOn())
+        notes++;
+    playHead.ppq += numSamples / SAMPLE_RATE * playHead.bpm / 60.0;
+  }
+  waitForGeneration(processor);
+  processor.releaseResources();
+
+  uint64_t allocations = AllocationGuard::count() - before;
+  std::printf("%d notes played, %llu allocations on the audio thread\n", notes,
+              static_cast<unsigned long long>(allocations));
+  if (notes == 0) {
+    std::printf("no melody was played\n");
+    return 1;
+  }
+  return allocations == 0 ? 0 : 1;
+}
@@ -0,0 +1,111 @@
+#ifndef AUDIO_STATS_HPP
+#define AUDIO_STATS_HPP
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Cost of processBlock on the audio thread. The audio thread only stores to
+// atomics (there is a single writer, so no read-modify-write loops); any other
+// thread reads them without ever blocking it.
+class AudioStats {
+public:
+  // Histogram of the block time as a fraction of the block's duration, with
+  // the upper edges of the buckets (the last one catches overruns)
+  static const int BUCKETS = 8;
+  static constexpr std::array<double, BUCKETS - 1> BUCKET_EDGES = {
+      0.01, 0.02, 0.05, 0.1, 0.25, 0.5, 1.0};
+
+  struct Snapshot {
+    uint64_t blocks = 0;
+    double busySeconds = 0.0;   // time spent in processBlock
+    double budgetSeconds = 0.0; // duration of the audio in those blocks
+    uint64_t events = 0;        // MIDI events emitted
+    uint64_t overruns = 0;      // blocks that took longer than their audio
+    std::array<uint64_t, BUCKETS> histogram{};
+    uint32_t maxEvents = 0; // in one block, since the last read()
+    float peakLoad = 0.0f;  // since the last read()
+    float worstLoad = 0.0f; // ever
+
+    double averageLoad() const {
+      return budgetSeconds > 0.0 ? busySeconds / budgetSeconds : 0.0;
+    }
+    // Counts between an earlier snapshot and this one, for a rolling view.
+    // The peaks are already per read().
+    Snapshot since(const Snapshot &earlier) const {
+      Snapshot window = *this;
+      window.blocks -= earlier.blocks;
+      window.busySeconds -= earlier.busySeconds;
+      window.budgetSeconds -= earlier.budgetSeconds;
+      window.events -= earlier.events;
+      window.overruns -= earlier.overruns;
+      for (int i = 0; i < BUCKETS; ++i)
+        window.histogram[i] -= earlier.histogram[i];
+      return window;
+    }
+  };
+
+  // Audio thread, once per block
+  void record(double busySeconds, double budgetSeconds, int events) {
+    float load =
+        budgetSeconds > 0.0 ? static_cast<float>(busySeconds / budgetSeconds)
+                            : 0.0f;
+    int bucket = 0;
+    while (bucket < BUCKETS - 1 && load >= BUCKET_EDGES[bucket])
+      bucket++;
+
+    add(blocks, 1);
+    add(busyNanoseconds, static_cast<uint64_t>(busySeconds * 1e9));
+    add(budgetNanoseconds, static_cast<uint64_t>(budgetSeconds * 1e9));
+    add(eventCount, events);
+    add(histogram[bucket], 1);
+    if (load > 1.0f)
+      add(overruns, 1);
+    raise(maxEvents, events);
+    raise(peakLoad, load);
+    raise(worstLoad, load);
+  }
+
+  // Any other thread. Starts a new window for the peaks.
+  Snapshot read() {
+    Snapshot snapshot;
+    snapshot.blocks = blocks.load(std::memory_order_relaxed);
+    snapshot.busySeconds =
+        busyNanoseconds.load(std::memory_order_relaxed) * 1e-9;
+    snapshot.budgetSeconds =
+        budgetNanoseconds.load(std::memory_order_relaxed) * 1e-9;
+    snapshot.events = eventCount.load(std::memory_order_relaxed);
+    snapshot.overruns = overruns.load(std::memory_order_relaxed);
+    for (int i = 0; i < BUCKETS; ++i)
+      snapshot.histogram[i] = histogram[i].load(std::memory_order_relaxed);
+    snapshot.maxEvents = maxEvents.exchange(0, std::memory_order_relaxed);
+    snapshot.peakLoad = peakLoad.exchange(0.0f, std::memory_order_relaxed);
+    snapshot.worstLoad = worstLoad.load(std::memory_order_relaxed);
+    return snapshot;
+  }
+
+private:
+  std::atomic<uint64_t> blocks{0};
+  std::atomic<uint64_t> busyNanoseconds{0};
+  std::atomic<uint64_t> budgetNanoseconds{0};
+  std::atomic<uint64_t> eventCount{0};
+  std::atomic<uint64_t> overruns{0};
+  std::array<std::atomic<uint64_t>, BUCKETS> histogram{};
+  std::atomic<uint32_t> maxEvents{0};
+  std::atomic<float> peakLoad{0.0f};
+  std::atomic<float> worstLoad{0.0f};
+
+  template <typename T, typename V>
+  static void add(std::atomic<T> &counter, V value) {
+    T sum = counter.load(std::memory_order_relaxed) + static_cast<T>(value);
+    counter.store(sum, std::memory_order_relaxed);
+  }
+  // A reader resetting the value in between only loses this one sample
+  template <typename T, typename V>
+  static void raise(std::atomic<T> &maximum, V value) {
+    if (maximum.load(std::memory_order_relaxed) < static_cast<T>(value))
+      maximum.store(static_cast<T>(value), std::memory_order_relaxed);
+  }
+};
+
+#endif // AUDIO_STATS_HPP
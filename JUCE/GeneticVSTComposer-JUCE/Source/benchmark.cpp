@@ -0,0 +1,547 @@
+// Built by CMakeLists.txt (target genetic_benchmark)
+//
+// ./genetic_benchmark [--filter text] [--quick] [--min-time 0.2]
+//                     [--generations 5] [--label text] [--out file.json]
+// ./genetic_benchmark --pareto [--seeds 3] [--targets 0.1,0.5,2]
+//                     [--local-search 0] [--label text] [--out file.json]
+// ./genetic_benchmark --train [--local-search 0] [--label text]
+//                     [--out file.json]
+//
+// Times every fitness feature and genetic operator on its own, and whole
+// runs, over population sizes (64 - 4096), melody lengths (1 - 16 measures)
+// and note durations (1/8 - 1/32). The results are written as JSON, so that
+// commits can be compared; the progress goes to stderr.
+//
+// --filter  only the cases whose name contains the text
+// --quick   the smallest and the largest value of every parameter
+// --label   stored with the results, e.g. the commit
+//
+// The similarity penalty grows with the square of the population, so the
+// runs of the largest populations take minutes.
+//
+// --pareto runs the whole algorithm over a grid of population sizes,
+// generation counts and seeds instead, and records the best and average
+// fitness against the time. The output has every sample, the Pareto
+// frontier of fitness over time (averaged over the seeds) and the presets
+// PresetCalibration picks for the latency targets on this machine.
+//
+// --train times what the plugin runs instead: its default speed/quality
+// presets on 1 - 4 measures of eighths and sixteenths, with its run options.
+// It takes seconds, and is the training workload of the PGO builds.
+
+#include "genetic.hpp"
+#include "preset_calibration.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifndef BENCHMARK_BUILD_TYPE
+#define BENCHMARK_BUILD_TYPE "unknown"
+#endif
+
+// Keeps the compiler from dropping the benchmarked calls
+template <typename T> void keep(const T &value) {
+#if defined(__GNUC__)
+  asm volatile("" : : "r"(&value) : "memory");
+#else
+  static volatile const void *sink;
+  sink = &value;
+#endif
+}
+
+struct Config {
+  int population;
+  float measures;
+  float noteDuration; // of a quarter note: 0.5 is 1/8, 0.125 is 1/32
+};
+
+struct Result {
+  std::string name;
+  std::string function;
+  Config config;
+  int length;          // steps per melody
+  long iterations;     // in total
+  double nsPerCall;    // median over the samples
+  double minNsPerCall; // fastest sample
+};
+
+struct Options {
+  std::string filter;
+  bool quick = false;
+  double minSeconds = 0.2; // per case
+  int generations = 5;     // of a benchmarked run()
+  std::string label;
+  std::string out;
+  // --pareto
+  bool pareto = false;
+  bool train = false;
+  int seeds = 3;
+  std::vector<double> targets = {0.1, 0.5, 2.0};
+  float localSearchMs = 0.0f;
+};
+
+std::string compiler() {
+#if defined(__clang__)
+  return "clang " __clang_version__;
+#elif defined(__GNUC__)
+  return "gcc " __VERSION__;
+#elif defined(_MSC_VER)
+  return "msvc " + std::to_string(_MSC_VER);
+#else
+  return "unknown";
+#endif
+}
+
+// The "context" object of the results
+std::string context(const Options &options) {
+  char date[32];
+  std::time_t now = std::time(nullptr);
+  std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::localtime(&now));
+  std::ostringstream out;
+  out << "{\"date\": \"" << date << "\", \"label\": \"" << options.label
+      << "\", \"build_type\": \"" << BENCHMARK_BUILD_TYPE
+      << "\", \"compiler\": \"" << compiler() << "\"}";
+  return out.str();
+}
+
+// Times function, in batches long enough for the clock, over a few samples
+void measure(const std::function<void()> &function, double minSeconds,
+             Result &result) {
+  using Clock = std::chrono::steady_clock;
+  auto time = [&](long calls) {
+    auto started = Clock::now();
+    for (long i = 0; i < calls; ++i)
+      function();
+    return std::chrono::duration<double>(Clock::now() - started).count();
+  };
+
+  const int SAMPLES = 5;
+  double first = time(1); // also warms the caches
+  if (first >= minSeconds / 2) {
+    result.iterations = 1;
+    result.nsPerCall = result.minNsPerCall = first * 1e9;
+    return;
+  }
+  long batch = std::max(1L, static_cast<long>(minSeconds / SAMPLES / first));
+  std::vector<double> samples;
+  for (int i = 0; i < SAMPLES; ++i)
+    samples.push_back(time(batch) / batch * 1e9);
+  std::sort(samples.begin(), samples.end());
+  result.iterations = 1 + batch * SAMPLES;
+  result.nsPerCall = samples[SAMPLES / 2];
+  result.minNsPerCall = samples.front();
+}
+
+class GeneticBenchmark {
+public:
+  GeneticBenchmark(const Options &options) : options(options) {}
+
+  void run() {
+    std::vector<int> populations = {64, 256, 1024, 4096};
+    std::vector<float> measures = {1.0f, 4.0f, 16.0f};
+    std::vector<float> durations = {0.5f, 0.25f, 0.125f};
+    if (options.quick) {
+      populations = {64, 4096};
+      measures = {1.0f, 16.0f};
+      durations = {0.5f, 0.125f};
+    }
+
+    // Cases on single melodies don't depend on the population size
+    for (float length : measures)
+      for (float duration : durations)
+        melodyCases({populations.front(), length, duration});
+    for (int population : populations)
+      for (float length : measures)
+        for (float duration : durations)
+          populationCases({population, length, duration});
+  }
+
+  void write(std::ostream &out) const {
+    out << "{\n  \"context\": " << context(options)
+        << ",\n  \"run_generations\": " << options.generations
+        << ",\n  \"benchmarks\": [";
+    for (size_t i = 0; i < results.size(); ++i) {
+      const Result &result = results[i];
+      out << (i ? ",\n" : "\n") << "    {\"name\": \"" << result.name
+          << "\", \"function\": \"" << result.function
+          << "\", \"population\": " << result.config.population
+          << ", \"measures\": " << result.config.measures
+          << ", \"note_duration\": " << result.config.noteDuration
+          << ", \"length\": " << result.length
+          << ", \"iterations\": " << result.iterations
+          << ", \"ns_per_call\": " << result.nsPerCall
+          << ", \"min_ns_per_call\": " << result.minNsPerCall << "}";
+    }
+    out << "\n  ]\n}\n";
+  }
+
+private:
+  const Options &options;
+  std::vector<Result> results;
+
+  static GeneticMelodyGenerator::Parameters parameters(const Config &config) {
+    GeneticMelodyGenerator::Parameters params;
+    params.populationSize = config.population;
+    params.noteDuration = config.noteDuration;
+    return params;
+  }
+
+  // A population like the ones run() evaluates: random melodies with some
+  // mutations, so that there are pauses and extensions
+  static std::vector<std::vector<int>>
+  population(GeneticMelodyGenerator &generator, const Config &config) {
+    const auto &meter = generator.meter;
+    int steps = static_cast<int>(meter.first / config.noteDuration * 4.0 /
+                                 meter.second * config.measures);
+    std::vector<std::vector<int>> melodies =
+        generator.generate_population(steps);
+    for (auto &melody : melodies)
+      for (int i = 0; i < 3; ++i)
+        generator.mutate(melody);
+    return melodies;
+  }
+
+  std::string caseName(const std::string &function, const Config &config,
+                       bool withPopulation) const {
+    std::ostringstream name;
+    name << function;
+    if (withPopulation)
+      name << "/population:" << config.population;
+    name << "/measures:" << config.measures << "/duration:1_"
+         << static_cast<int>(4.0f / config.noteDuration + 0.5f);
+    return name.str();
+  }
+
+  void add(const std::string &function, const Config &config,
+           bool withPopulation, int length,
+           const std::function<void()> &body) {
+    Result result;
+    result.name = caseName(function, config, withPopulation);
+    if (result.name.find(options.filter) == std::string::npos)
+      return;
+    result.function = function;
+    result.config = config;
+    result.length = length;
+    measure(body, options.minSeconds, result);
+    std::cerr << result.name << ": " << result.nsPerCall << " ns\n";
+    results.push_back(result);
+  }
+
+  // Features and operators of single melodies, cycling through a population
+  void melodyCases(const Config &config) {
+    GeneticMelodyGenerator generator(parameters(config));
+    generator.set_seed(1);
+    std::vector<std::vector<int>> melodies = population(generator, config);
+    int length = static_cast<int>(melodies.front().size());
+    size_t next = 0;
+    auto melody = [&]() -> const std::vector<int> & {
+      next = (next + 1) % melodies.size();
+      return melodies[next];
+    };
+
+    using Feature = float (GeneticMelodyGenerator::*)(const std::vector<int> &)
+        const;
+    using FeaturePair = std::pair<float, float> (GeneticMelodyGenerator::*)(
+        const std::vector<int> &) const;
+    const std::pair<const char *, Feature> features[] = {
+        {"fitness_directional_changes",
+         &GeneticMelodyGenerator::fitness_directional_changes},
+        {"fitness_melodic_contour",
+         &GeneticMelodyGenerator::fitness_melodic_contour},
+        {"fitness_note_range", &GeneticMelodyGenerator::fitness_note_range},
+        {"fitness_average_pitch",
+         &GeneticMelodyGenerator::fitness_average_pitch},
+        {"fitness_pause_proportion",
+         &GeneticMelodyGenerator::fitness_pause_proportion},
+        {"fitness_pitch_variation",
+         &GeneticMelodyGenerator::fitness_pitch_variation},
+        {"fitness_odd_index_notes",
+         &GeneticMelodyGenerator::fitness_odd_index_notes},
+        {"fitness_note_diversity",
+         &GeneticMelodyGenerator::fitness_note_diversity},
+        {"fitness_diversity_intervals",
+         &GeneticMelodyGenerator::fitness_diversity_intervals},
+        {"fitness_rhythm", &GeneticMelodyGenerator::fitness_rhythm},
+        {"proportion_of_long_notes",
+         &GeneticMelodyGenerator::proportion_of_long_notes},
+        {"fitness_average_intervals",
+         &GeneticMelodyGenerator::fitness_average_intervals},
+        {"fitness_small_intervals",
+         &GeneticMelodyGenerator::fitness_small_intervals},
+        {"fitness_repeated_short_notes",
+         &GeneticMelodyGenerator::fitness_repeated_short_notes},
+    };
+    const std::pair<const char *, FeaturePair> featurePairs[] = {
+        {"fitness_intervals", &GeneticMelodyGenerator::fitness_intervals},
+        {"fitness_scale_and_chord",
+         &GeneticMelodyGenerator::fitness_scale_and_chord},
+        {"fitness_log_rhythmic_value",
+         &GeneticMelodyGenerator::fitness_log_rhythmic_value},
+    };
+    for (const auto &feature : features)
+      add(feature.first, config, false, length, [&] {
+        keep((generator.*feature.second)(melody()));
+      });
+    for (const auto &feature : featurePairs)
+      add(feature.first, config, false, length, [&] {
+        keep((generator.*feature.second)(melody()));
+      });
+
+    // all features the way run() extracts them, and their score
+    add("extract_features", config, false, length,
+        [&] { keep(generator.extract_features(melody())); });
+    GeneticMelodyGenerator::FeatureVector vector =
+        generator.extract_features(melodies.front());
+    add("score_features", config, false, length,
+        [&] { keep(generator.score_features(vector)); });
+
+    // The operators change their own copies of the melodies
+    std::vector<std::vector<int>> mutated = melodies;
+    add("mutate", config, false, length, [&] {
+      next = (next + 1) % mutated.size();
+      keep(generator.mutate(mutated[next]));
+    });
+    add("crossover", config, false, length, [&] {
+      const std::vector<int> &first = melody();
+      keep(generator.crossover(first, melody()));
+    });
+  }
+
+  // Everything that looks at the whole population
+  void populationCases(const Config &config) {
+    GeneticMelodyGenerator generator(parameters(config));
+    generator.set_seed(1);
+    std::vector<std::vector<int>> melodies = population(generator, config);
+    int length = static_cast<int>(melodies.front().size());
+    size_t next = 0;
+    auto melody = [&]() -> const std::vector<int> & {
+      next = (next + 1) % melodies.size();
+      return melodies[next];
+    };
+
+    add("calculate_similarity_penalty", config, true, length, [&] {
+      keep(generator.calculate_similarity_penalty(melody(), melodies));
+    });
+    add("fitness", config, true, length,
+        [&] { keep(generator.fitness(melody(), melodies)); });
+    add("tournament_selection", config, true, length,
+        [&] { keep(generator.tournament_selection(melodies)); });
+    std::vector<float> scores(melodies.size());
+    for (size_t i = 0; i < scores.size(); ++i)
+      scores[i] = static_cast<float>(i % 97);
+    add("tournament_selection_scores", config, true, length,
+        [&] { keep(generator.tournament_selection(scores)); });
+    // Telemetry of one generation, to compare with run / generations
+    std::vector<float> similarity(melodies.size(), 0.5f);
+    generator.set_telemetry(std::make_shared<RingBufferTelemetrySink>(64));
+    add("report_generation", config, true, length, [&] {
+      generator.report_generation(0, 1, melodies, scores, similarity);
+    });
+
+    GeneticMelodyGenerator::Parameters params = parameters(config);
+    params.numGenerations = options.generations;
+    add("run", config, true, length, [&] {
+      GeneticMelodyGenerator runner(params);
+      runner.set_seed(1);
+      keep(runner.run(config.measures));
+    });
+    add("run_telemetry", config, true, length, [&] {
+      GeneticMelodyGenerator runner(params);
+      runner.set_seed(1);
+      runner.set_telemetry(std::make_shared<RingBufferTelemetrySink>(64));
+      keep(runner.run(config.measures));
+    });
+  }
+};
+
+// The plugin's run options
+PresetCalibration::Setup pluginSetup(float localSearchMs) {
+  return [localSearchMs](GeneticMelodyGenerator &generator) {
+    generator.set_local_search(localSearchMs);
+    generator.set_adaptive_operators(true);
+    GeneticMelodyGenerator::RepairOptions repair;
+    repair.leadingExtension = true;
+    repair.noteRange = true;
+    generator.set_repair(repair);
+  };
+}
+
+// Quality against time of whole runs, see --pareto above
+void paretoBenchmark(const Options &options, std::ostream &out) {
+  const int populations[] = {16, 32, 64, 128, 256, 512};
+  const int generations[] = {10, 25, 50, 100, 200, 400};
+  const float MEASURES = 2.0f;
+  GeneticMelodyGenerator::Parameters params;
+  params.noteDuration = 0.25f;
+  PresetCalibration::Setup setup = pluginSetup(options.localSearchMs);
+
+  std::vector<PresetCalibration::Sample> samples;
+  std::vector<PresetCalibration::Sample> means; // over the seeds
+  for (int population : populations) {
+    for (int generation : generations) {
+      PresetCalibration::Sample mean{{population, generation}, 0, 0.0, 0.0f,
+                                     0.0f};
+      for (int seed = 1; seed <= options.seeds; ++seed) {
+        PresetCalibration::Sample sample = PresetCalibration::measure(
+            params, {population, generation}, MEASURES, seed, setup);
+        std::cerr << population << " x " << generation << " seed " << seed
+                  << ": " << sample.seconds << " s, best "
+                  << sample.bestFitness << "\n";
+        samples.push_back(sample);
+        mean.seconds += sample.seconds / options.seeds;
+        mean.bestFitness += sample.bestFitness / options.seeds;
+        mean.averageFitness += sample.averageFitness / options.seeds;
+      }
+      means.push_back(mean);
+    }
+  }
+  std::vector<PresetCalibration::Sample> frontier =
+      PresetCalibration::paretoFrontier(means);
+  std::vector<PresetCalibration::Preset> presets =
+      PresetCalibration::calibrate(params, MEASURES, options.targets, setup);
+
+  auto writeSamples = [&](const std::vector<PresetCalibration::Sample> &list) {
+    for (size_t i = 0; i < list.size(); ++i) {
+      const PresetCalibration::Sample &sample = list[i];
+      out << (i ? ",\n" : "\n") << "    {\"population\": "
+          << sample.preset.populationSize
+          << ", \"generations\": " << sample.preset.numGenerations
+          << ", \"seed\": " << sample.seed
+          << ", \"seconds\": " << sample.seconds
+          << ", \"best_fitness\": " << sample.bestFitness
+          << ", \"average_fitness\": " << sample.averageFitness << "}";
+    }
+  };
+  out << "{\n  \"context\": " << context(options)
+      << ",\n  \"measures\": " << MEASURES
+      << ", \"note_duration\": " << params.noteDuration
+      << ", \"local_search_ms\": " << options.localSearchMs
+      << ",\n  \"samples\": [";
+  writeSamples(samples);
+  out << "\n  ],\n  \"frontier\": [";
+  writeSamples(frontier);
+  out << "\n  ],\n  \"presets\": [";
+  for (size_t i = 0; i < presets.size(); ++i)
+    out << (i ? ",\n" : "\n") << "    {\"target_seconds\": "
+        << options.targets[i]
+        << ", \"population\": " << presets[i].populationSize
+        << ", \"generations\": " << presets[i].numGenerations << "}";
+  out << "\n  ]\n}\n";
+}
+
+// The runs of the plugin, see --train above
+void trainingBenchmark(const Options &options, std::ostream &out) {
+  // the presets before the calibration, see PluginProcessor.h
+  const PresetCalibration::Preset presets[] = {
+      {64, 50}, {128, 100}, {256, 200}};
+  const float measures[] = {1.0f, 2.0f, 4.0f};
+  const float durations[] = {0.5f, 0.25f};
+  PresetCalibration::Setup setup = pluginSetup(options.localSearchMs);
+
+  out << "{\n  \"context\": " << context(options)
+      << ",\n  \"local_search_ms\": " << options.localSearchMs
+      << ",\n  \"runs\": [";
+  bool first = true;
+  for (const PresetCalibration::Preset &preset : presets) {
+    for (float length : measures) {
+      for (float duration : durations) {
+        GeneticMelodyGenerator::Parameters params;
+        params.noteDuration = duration;
+        PresetCalibration::Sample sample =
+            PresetCalibration::measure(params, preset, length, 1, setup);
+        std::cerr << preset.populationSize << " x " << preset.numGenerations
+                  << ", " << length << " measures of " << duration << ": "
+                  << sample.seconds << " s\n";
+        out << (first ? "\n" : ",\n") << "    {\"population\": "
+            << preset.populationSize
+            << ", \"generations\": " << preset.numGenerations
+            << ", \"measures\": " << length
+            << ", \"note_duration\": " << duration
+            << ", \"seconds\": " << sample.seconds
+            << ", \"best_fitness\": " << sample.bestFitness << "}";
+        first = false;
+      }
+    }
+  }
+  out << "\n  ]\n}\n";
+}
+
+bool parseOptions(int argc, char **argv, Options &options) {
+  for (int i = 1; i < argc; ++i) {
+    std::string name = argv[i];
+    if (name == "--quick" || name == "--pareto" || name == "--train") {
+      bool &flag = name == "--quick"    ? options.quick
+                   : name == "--pareto" ? options.pareto
+                                        : options.train;
+      flag = true;
+      continue;
+    }
+    if (i + 1 == argc)
+      return false;
+    std::string value = argv[++i];
+    if (name == "--filter")
+      options.filter = value;
+    else if (name == "--min-time")
+      options.minSeconds = std::stod(value);
+    else if (name == "--generations")
+      options.generations = std::stoi(value);
+    else if (name == "--label")
+      options.label = value;
+    else if (name == "--out")
+      options.out = value;
+    else if (name == "--seeds")
+      options.seeds = std::stoi(value);
+    else if (name == "--local-search")
+      options.localSearchMs = std::stof(value);
+    else if (name == "--targets") {
+      options.targets.clear();
+      std::istringstream targets(value);
+      std::string target;
+      while (std::getline(targets, target, ','))
+        options.targets.push_back(std::stod(target));
+      std::sort(options.targets.begin(), options.targets.end());
+    } else
+      return false;
+  }
+  return options.minSeconds > 0.0 && options.generations > 0 &&
+         options.seeds > 0 && !options.targets.empty();
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  if (!parseOptions(argc, argv, options)) {
+    std::cerr << "usage: see the top of benchmark.cpp\n";
+    return 2;
+  }
+
+  std::ostringstream json;
+  if (options.pareto) {
+    paretoBenchmark(options, json);
+  } else if (options.train) {
+    trainingBenchmark(options, json);
+  } else {
+    GeneticBenchmark benchmark(options);
+    benchmark.run();
+    benchmark.write(json);
+  }
+
+  if (options.out.empty()) {
+    std::cout << json.str();
+  } else {
+    std::ofstream file(options.out);
+    file << json.str();
+    if (!file) {
+      std::cerr << "can't write " << options.out << "\n";
+      return 1;
+    }
+  }
+  return 0;
+}
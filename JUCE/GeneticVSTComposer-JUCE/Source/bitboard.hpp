@@ -0,0 +1,79 @@
+#ifndef BITBOARD_HPP
+#define BITBOARD_HPP
+
+#include <array>
+#include <cstdint>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Operations on 64-bit masks, used by the bitboard melody features
+namespace Bits {
+
+inline int popcount(uint64_t x) {
+#if defined(_MSC_VER)
+  return static_cast<int>(__popcnt64(x));
+#else
+  return __builtin_popcountll(x);
+#endif
+}
+
+// Index of the lowest set bit. x must not be 0.
+inline int countTrailingZeros(uint64_t x) {
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward64(&index, x);
+  return static_cast<int>(index);
+#else
+  return __builtin_ctzll(x);
+#endif
+}
+
+// Number of consecutive set bits starting from bit 0
+inline int countTrailingOnes(uint64_t x) {
+  return x == ~uint64_t(0) ? 64 : countTrailingZeros(~x);
+}
+
+// Mask of the n lowest bits, n in 0..64
+inline uint64_t lowMask(int n) {
+  return n >= 64 ? ~uint64_t(0) : (uint64_t(1) << n) - 1;
+}
+
+// Runs of set bits in runs that contain one of the seeds. The seeds have to
+// be the lowest bits of their runs - the addition carries each of them
+// through its run.
+inline uint64_t fillRuns(uint64_t runs, uint64_t seeds) {
+  return ((runs + seeds) ^ runs) & runs;
+}
+
+// Clears the lowest run of set bits
+inline uint64_t clearLowestRun(uint64_t x) {
+  return x & (x + (x & (~x + 1)));
+}
+
+// Set of the integers 0..Size-1, for counting distinct values without
+// allocating (MIDI pitches, interval classes, run lengths)
+template <int Size> class UniqueCounter {
+public:
+  void clear() { words.fill(0); }
+
+  // Values outside 0..Size-1 are ignored
+  void insert(int value) {
+    if (static_cast<unsigned>(value) < static_cast<unsigned>(Size))
+      words[value >> 6] |= uint64_t(1) << (value & 63);
+  }
+
+  int size() const {
+    int count = 0;
+    for (uint64_t word : words)
+      count += popcount(word);
+    return count;
+  }
+
+private:
+  std::array<uint64_t, (Size + 63) / 64> words{};
+};
+
+} // namespace Bits
+
+#endif // BITBOARD_HPP
@@ -1,40 +1,144 @@
 #include "genetic.hpp"
+#include "bitboard.hpp"
 #include "mingus.hpp"
 #include "notes_generator.hpp"
+#include "scale_table.hpp"
+#include "trace.hpp"
 #include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <fstream>
-#include <iostream>
 #include <numeric>
 #include <set>
 #include <unordered_set>
 
+const std::array<std::string, GeneticMelodyGenerator::FEATURE_COUNT>
+    GeneticMelodyGenerator::FEATURE_NAMES = {"average_interval",
+                                             "average_pitch",
+                                             "deviation_rhythmic_value",
+                                             "dissonance",
+                                             "diversity",
+                                             "diversity_interval",
+                                             "large_intervals",
+                                             "melodic_contour",
+                                             "odd_index_notes",
+                                             "pause_proportion",
+                                             "pitch_range",
+                                             "pitch_variation",
+                                             "rhythmic_average_value",
+                                             "rhythmic_diversity",
+                                             "root_conformance",
+                                             "scale_conformance",
+                                             "scale_playing",
+                                             "short_consecutive_notes"};
+
+const std::array<std::string, GeneticMelodyGenerator::OPERATOR_COUNT>
+    GeneticMelodyGenerator::OPERATOR_NAMES = {
+        "extension", "pause",     "extension_run", "note_replacement",
+        "interval",  "transpose", "sort",          "crossover"};
+
+GeneticMelodyGenerator::GeneticMelodyGenerator(const Parameters &params)
+    : mutationRate(0.3f), crossoverRate(0.9f) {
+  std::random_device rd;
+  rng = std::mt19937(rd());
+
+  configure(params);
+  reset_operators();
+}
+
 GeneticMelodyGenerator::GeneticMelodyGenerator(
     int mode, const std::string &scale, const std::pair<int, int> &noteRange,
     float diversity, float dynamics, float arousal, float pauseAmount,
     float valence, float jazziness, float weirdness,
     const std::pair<int, int> &meter, float noteDuration, int populationSize,
     int numGenerations)
-    : mode(mode), diversity(diversity), dynamics(dynamics), arousal(arousal),
-      pauseAmount(pauseAmount), valence(valence), jazziness(jazziness),
-      weirdness(weirdness), meter(meter), noteDuration(noteDuration),
-      populationSize(populationSize), numGenerations(numGenerations),
-      mutationRate(0.3f), crossoverRate(0.9f), 
-      expectedLength(static_cast<int>(1 / noteDuration)),
-      notesRange(noteRange.second - noteRange.first) {
-
-  std::random_device rd;   
-  rng = std::mt19937(rd());
+    : GeneticMelodyGenerator(Parameters{
+          mode, scale, noteRange, diversity, dynamics, arousal, pauseAmount,
+          valence, jazziness, weirdness, meter, noteDuration, populationSize,
+          numGenerations}) {}
+
+void GeneticMelodyGenerator::configure(const Parameters &params) {
+  const Parameters &current = this->params;
+  bool range_changed = !configured || params.noteRange != current.noteRange;
+  bool scale_changed = !configured || params.scale != current.scale;
+  bool rhythm_changed = !configured || params.mode != current.mode ||
+                        params.meter != current.meter ||
+                        params.noteDuration != current.noteDuration;
+  bool sliders_changed =
+      !configured || params.diversity != current.diversity ||
+      params.dynamics != current.dynamics ||
+      params.arousal != current.arousal ||
+      params.pauseAmount != current.pauseAmount ||
+      params.valence != current.valence ||
+      params.jazziness != current.jazziness ||
+      params.weirdness != current.weirdness;
+
+  NotesGenerator generator = NotesGenerator(params.scale);
+  if (range_changed) {
+    NOTES = generator.generateChromaticNotes(params.noteRange);
+    notesRange = params.noteRange.second - params.noteRange.first;
+  }
+
+  // Another name can still resolve to the same scale ("C Ionian")
+  bool tables_changed = false;
+  if (scale_changed) {
+    ScaleTable::Key key = generator.chooseScale();
+    tables_changed = !configured || ScaleTable::scaleId(key) != scaleId;
+    scaleId = ScaleTable::scaleId(key);
+    scaleMask = ScaleTable::pitchClassMask(key);
+    rootPitchClass = key.tonic;
+  }
+  if (tables_changed) {
+    for (int pitch_class = 0; pitch_class < 12; ++pitch_class) {
+      int below = 0;
+      while (below < 12 && !in_scale(pitch_class - below + 12))
+        below++;
+      int above = 0;
+      while (above < 12 && !in_scale(pitch_class + above))
+        above++;
+      scaleOffsetBelow[pitch_class] = below < 12 ? -below : 0;
+      scaleOffsetAbove[pitch_class] = above < 12 ? above : 0;
+    }
+  }
 
-  NotesGenerator generator = NotesGenerator(scale);
+  mode = params.mode;
+  meter = params.meter;
+  noteDuration = params.noteDuration;
+  expectedLength = static_cast<int>(1 / noteDuration);
+  populationSize = params.populationSize;
+  numGenerations = params.numGenerations;
+  if (sliders_changed) {
+    set_parameters(params.diversity, params.dynamics, params.arousal,
+                   params.pauseAmount, params.valence, params.jazziness,
+                   params.weirdness);
+  }
 
-  int notesCount = noteRange.second - noteRange.first + 1;
+  // The cached features were extracted for the old scale, range or rhythm
+  if (range_changed || tables_changed || rhythm_changed) {
+    drop_cached_population();
+  }
 
-  NOTES = generator.generateChromaticNotes(noteRange);
-  scale_notes = NotesGenerator(scale).generateNotes(
-      1, 0); // first is n.o. octaves, second is start octave
+  this->params = params;
+  configured = true;
+}
 
-  set_coefficients();
+const GeneticMelodyGenerator::Parameters &
+GeneticMelodyGenerator::parameters() const {
+  return params;
+}
+
+void GeneticMelodyGenerator::reset() {
+  drop_cached_population();
+  reset_operators();
+}
+
+void GeneticMelodyGenerator::set_seed(uint32_t seed) { rng.seed(seed); }
+
+void GeneticMelodyGenerator::drop_cached_population() {
+  cachedPopulation.clear();
+  cachedFeatures.clear();
+  cachedSimilarity.clear();
+  seedPopulation.clear();
 }
 
 void GeneticMelodyGenerator::set_coefficients(
@@ -115,12 +219,46 @@ void GeneticMelodyGenerator::set_coefficients(
                                        {"scale_playing", 2},
                                        {"short_consecutive_notes", 2}}
           : weights;
+
+  // Features without all three coefficients are skipped by the fitness
+  for (int i = 0; i < FEATURE_COUNT; ++i) {
+    const std::string &feature = FEATURE_NAMES[i];
+    featureEnabled[i] = muValues.find(feature) != muValues.end() &&
+                        sigmaValues.find(feature) != sigmaValues.end() &&
+                        this->weights.find(feature) != this->weights.end();
+    featureMu[i] = featureEnabled[i] ? muValues[feature] : 0.0f;
+    featureSigma[i] = featureEnabled[i] ? sigmaValues[feature] : 1.0f;
+    featureWeight[i] = featureEnabled[i] ? this->weights[feature] : 0;
+  }
 }
 
-void GeneticMelodyGenerator::mutate(std::vector<int> &melody) {
+void GeneticMelodyGenerator::set_parameters(float diversity, float dynamics,
+                                            float arousal, float pauseAmount,
+                                            float valence, float jazziness,
+                                            float weirdness) {
+  this->diversity = diversity;
+  this->dynamics = dynamics;
+  this->arousal = arousal;
+  this->pauseAmount = pauseAmount;
+  this->valence = valence;
+  this->jazziness = jazziness;
+  this->weirdness = weirdness;
+  // parameters() and configure() see the sliders of a rerank too
+  params.diversity = diversity;
+  params.dynamics = dynamics;
+  params.arousal = arousal;
+  params.pauseAmount = pauseAmount;
+  params.valence = valence;
+  params.jazziness = jazziness;
+  params.weirdness = weirdness;
+  set_coefficients();
+}
+
+unsigned GeneticMelodyGenerator::mutate(std::vector<int> &melody) {
+  TRACE_SCOPE("mutation");
   std::uniform_real_distribution<float> prob_dist(0.0, 1.0);
   std::uniform_int_distribution<int> interval_dist(-12, 12);
-  float MUTATION_RATE = 0.3;
+  unsigned applied = 0;
   std::vector<int> valid_indices;
   for (int i = 0; i < melody.size(); ++i) {
     if (melody[i] != -1 && melody[i] != -2) {
@@ -131,8 +269,10 @@ void GeneticMelodyGenerator::mutate(std::vector<int> &melody) {
   // For normal mode or rythm generation
   if (mode != 2) {
     // Extension mutation
-    if (std::uniform_real_distribution<float>(0.0, 1.0)(rng) < MUTATION_RATE &&
+    if (std::uniform_real_distribution<float>(0.0, 1.0)(rng) <
+            operatorRates[EXTENSION_MUTATION] &&
         valid_indices.size() > 1 && !melody.empty()) {
+      applied |= 1u << EXTENSION_MUTATION;
       // Adjust the range for uniform_int_distribution to exclude the first
       // index
       int extend_index = valid_indices[std::uniform_int_distribution<int>(
@@ -143,8 +283,10 @@ void GeneticMelodyGenerator::mutate(std::vector<int> &melody) {
 
     // Pause mutation
     if (pauseAmount > 0.0 &&
-        std::uniform_real_distribution<float>(0.0, 1.0)(rng) < MUTATION_RATE &&
+        std::uniform_real_distribution<float>(0.0, 1.0)(rng) <
+            operatorRates[PAUSE_MUTATION] &&
         !melody.empty()) {
+      applied |= 1u << PAUSE_MUTATION;
       int replace_index =
           std::uniform_int_distribution<int>(0, melody.size() - 1)(rng);
       if (melody[replace_index] == -1) {
@@ -161,8 +303,10 @@ void GeneticMelodyGenerator::mutate(std::vector<int> &melody) {
     }
 
     // Extension mutation
-    if (std::uniform_real_distribution<float>(0.0, 1.0)(rng) < MUTATION_RATE &&
+    if (std::uniform_real_distribution<float>(0.0, 1.0)(rng) <
+            operatorRates[EXTENSION_RUN_MUTATION] &&
         valid_indices.size() > 1) {
+      applied |= 1u << EXTENSION_RUN_MUTATION;
       // Adjust the range to exclude index 0 from being chosen for the start of
       // extension
       int start_index = valid_indices[std::uniform_int_distribution<int>(
@@ -187,8 +331,10 @@ void GeneticMelodyGenerator::mutate(std::vector<int> &melody) {
     }
 
     // Note replacement mutation within extensions
-    if (std::uniform_real_distribution<float>(0.0, 1.0)(rng) < MUTATION_RATE &&
+    if (std::uniform_real_distribution<float>(0.0, 1.0)(rng) <
+            operatorRates[NOTE_REPLACEMENT_MUTATION] &&
         valid_indices.size() > 1) {
+      applied |= 1u << NOTE_REPLACEMENT_MUTATION;
       int chosen_index = valid_indices[std::uniform_int_distribution<int>(
           0, valid_indices.size() - 1)(rng)];
       int chosen_note = melody[chosen_index];
@@ -233,7 +379,8 @@ void GeneticMelodyGenerator::mutate(std::vector<int> &melody) {
   if (mode != 1) {
     // Melodic mutations
     // change two notes into interwal
-    if (prob_dist(rng) < MUTATION_RATE && !melody.empty()) {
+    if (prob_dist(rng) < operatorRates[INTERVAL_MUTATION] && !melody.empty()) {
+      applied |= 1u << INTERVAL_MUTATION;
       std::uniform_int_distribution<int> index_dist(0, melody.size() - 1);
       int first_note_index = index_dist(rng);
       int second_note_index;
@@ -249,7 +396,9 @@ void GeneticMelodyGenerator::mutate(std::vector<int> &melody) {
     }
 
     // Transpose melody fragment
-    if (prob_dist(rng) < MUTATION_RATE && !melody.empty()) {
+    if (prob_dist(rng) < operatorRates[TRANSPOSE_MUTATION] &&
+        !melody.empty()) {
+      applied |= 1u << TRANSPOSE_MUTATION;
       std::uniform_int_distribution<int> index_dist(0, melody.size() - 1);
       int start_index = index_dist(rng);
       int length = std::uniform_int_distribution<int>(
@@ -271,8 +420,10 @@ void GeneticMelodyGenerator::mutate(std::vector<int> &melody) {
     }
 
     // Sort mutation
-    if (std::uniform_real_distribution<float>(0.0, 1.0)(rng) < mutationRate &&
+    if (std::uniform_real_distribution<float>(0.0, 1.0)(rng) <
+            operatorRates[SORT_MUTATION] &&
         !melody.empty()) {
+      applied |= 1u << SORT_MUTATION;
       int start_index = std::uniform_int_distribution<int>(
           0, static_cast<int>(melody.size()) - 1)(rng);
       float max_length = meter.first * 8 / meter.second;
@@ -317,10 +468,13 @@ void GeneticMelodyGenerator::mutate(std::vector<int> &melody) {
       }
     }
   }
+
+  return applied;
 }
 
 std::vector<std::vector<int>>
 GeneticMelodyGenerator::generate_population(int note_amount) {
+  TRACE_SCOPE("population_init");
   std::vector<std::vector<int>> population;
   std::uniform_int_distribution<int> note_dist(
       0, NOTES.size() - 1); // Distribution for NOTES indices
@@ -353,6 +507,7 @@ GeneticMelodyGenerator::generate_population(int note_amount) {
 std::vector<std::vector<int>>
 GeneticMelodyGenerator::generate_population_from_template(
     const std::vector<int> &template_individual) {
+  TRACE_SCOPE("population_init");
   std::vector<std::vector<int>> population;
   std::uniform_int_distribution<int> note_dist(0, NOTES.size() - 1);
 
@@ -374,6 +529,7 @@ GeneticMelodyGenerator::generate_population_from_template(
 
 std::vector<std::vector<int>>
 GeneticMelodyGenerator::generate_population_fixed(int note_amount) {
+  TRACE_SCOPE("population_init");
   std::vector<std::vector<int>> population;
 
   for (int i = 0; i < populationSize; ++i) {
@@ -387,6 +543,7 @@ GeneticMelodyGenerator::generate_population_fixed(int note_amount) {
 std::pair<std::vector<int>, std::vector<int>>
 GeneticMelodyGenerator::crossover(const std::vector<int> &parent1,
                                   const std::vector<int> &parent2) {
+  TRACE_SCOPE("crossover");
   std::uniform_int_distribution<int> dist(
       1, parent1.size() - 2); // Prevent creatiion of edge cases
   int index = dist(rng);
@@ -418,8 +575,196 @@ std::vector<int> GeneticMelodyGenerator::tournament_selection(
   return best;
 }
 
+int GeneticMelodyGenerator::tournament_selection(
+    const std::vector<float> &scores, int tournament_size) {
+  TRACE_SCOPE("selection");
+  std::uniform_int_distribution<int> dist(0, scores.size() - 1);
+  float best_fitness = -std::numeric_limits<float>::infinity();
+  int best = 0;
+
+  for (int i = 0; i < tournament_size; ++i) {
+    int candidate = dist(rng);
+    if (scores[candidate] > best_fitness) {
+      best_fitness = scores[candidate];
+      best = candidate;
+    }
+  }
+
+  return best;
+}
+
+void GeneticMelodyGenerator::set_repair(const RepairOptions &options) {
+  repairOptions = options;
+}
+
+void GeneticMelodyGenerator::repair(std::vector<int> &melody) const {
+  if (melody.empty())
+    return;
+
+  // A melody can't start with an extension - it takes the pitch of the first
+  // note instead
+  if (repairOptions.leadingExtension && melody[0] == -2) {
+    int first_note = NOTES[0];
+    if (mode != 1) {
+      auto it = std::find_if(melody.begin(), melody.end(),
+                             [](int note) { return note >= 0; });
+      if (it != melody.end())
+        first_note = *it;
+    }
+    melody[0] = first_note;
+  }
+
+  for (int &note : melody) {
+    if (note < 0)
+      continue;
+    if (repairOptions.noteRange)
+      note = std::min(std::max(note, NOTES.front()), NOTES.back());
+    // Rhythm mode keeps its single pitch
+    if (repairOptions.snapToScale && mode != 1) {
+      int below = note + scaleOffsetBelow[note % 12];
+      int above = note + scaleOffsetAbove[note % 12];
+      // Nearest scale note, upwards on ties, as long as it's in the range
+      bool above_fits = above <= NOTES.back();
+      bool below_fits = below >= NOTES.front();
+      if (above_fits && (!below_fits || above - note <= note - below))
+        note = above;
+      else if (below_fits)
+        note = below;
+    }
+  }
+}
+
+void GeneticMelodyGenerator::set_adaptive_operators(bool enabled) {
+  adaptiveOperators = enabled;
+}
+
+void GeneticMelodyGenerator::set_progress_callback(ProgressCallback callback) {
+  progressCallback = std::move(callback);
+}
+
+void GeneticMelodyGenerator::set_cancellation_check(CancellationCheck check) {
+  cancellationCheck = std::move(check);
+}
+
+void GeneticMelodyGenerator::set_telemetry(
+    std::shared_ptr<TelemetrySink> sink) {
+  telemetry = std::move(sink);
+}
+
+void GeneticMelodyGenerator::report_generation(
+    int generation, int generations,
+    const std::vector<std::vector<int>> &population,
+    const std::vector<float> &scores, const std::vector<float> &similarity) {
+  runEvaluations += static_cast<int64_t>(scores.size());
+  if ((!progressCallback && !telemetry) || scores.empty())
+    return;
+  auto [lowest, highest] = std::minmax_element(scores.begin(), scores.end());
+  float average =
+      std::accumulate(scores.begin(), scores.end(), 0.0f) / scores.size();
+  if (progressCallback)
+    progressCallback({generation, generations, *highest, average});
+  if (!telemetry)
+    return;
+
+  float average_similarity =
+      std::accumulate(similarity.begin(), similarity.end(), 0.0f) /
+      similarity.size();
+  // Duplicates are equal neighbours among the sorted hashes (FNV-1a) of the
+  // melodies, O(n log n) next to the O(n^2) similarity penalty
+  melodyHashes.clear();
+  for (const auto &melody : population) {
+    uint64_t hash = 14695981039346656037ull;
+    for (int note : melody) {
+      hash ^= static_cast<uint32_t>(note);
+      hash *= 1099511628211ull;
+    }
+    melodyHashes.push_back(hash);
+  }
+  std::sort(melodyHashes.begin(), melodyHashes.end());
+  size_t duplicates = 0;
+  for (size_t i = 1; i < melodyHashes.size(); ++i)
+    duplicates += melodyHashes[i] == melodyHashes[i - 1];
+
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - runStarted;
+  telemetry->record({generation, generations, *lowest, average, *highest,
+                     1.0f - average_similarity,
+                     static_cast<float>(duplicates) / population.size(),
+                     runEvaluations, elapsed.count()});
+}
+
+void GeneticMelodyGenerator::reset_operators() {
+  for (int op = 0; op < OPERATOR_COUNT; ++op) {
+    operatorRates[op] = op == CROSSOVER ? crossoverRate : mutationRate;
+    operatorQuality[op] = 1.0f;
+    operatorApplications[op] = 0;
+    operatorImprovements[op] = 0;
+  }
+}
+
+std::vector<GeneticMelodyGenerator::OperatorStats>
+GeneticMelodyGenerator::operator_stats() const {
+  std::vector<OperatorStats> stats;
+  for (int op = 0; op < OPERATOR_COUNT; ++op) {
+    stats.push_back({OPERATOR_NAMES[op], operatorApplications[op],
+                     operatorImprovements[op], operatorRates[op]});
+  }
+  return stats;
+}
+
+void GeneticMelodyGenerator::credit_operators(
+    const std::vector<unsigned> &offspring_operators,
+    const std::vector<float> &parent_scores,
+    const std::vector<float> &scores) {
+  const float ADAPTATION_RATE = 0.2f; // weight of the latest generation
+  std::array<float, OPERATOR_COUNT> reward_sum{};
+  std::array<int, OPERATOR_COUNT> applications{};
+
+  for (size_t k = 0; k < offspring_operators.size() && k < scores.size();
+       ++k) {
+    float improvement = scores[k] - parent_scores[k];
+    for (int op = 0; op < OPERATOR_COUNT; ++op) {
+      if (offspring_operators[k] & (1u << op)) {
+        applications[op]++;
+        operatorApplications[op]++;
+        if (improvement > 0) {
+          reward_sum[op] += improvement;
+          operatorImprovements[op]++;
+        }
+      }
+    }
+  }
+  if (!adaptiveOperators)
+    return;
+
+  // Probability matching - operators earn rates proportional to their
+  // average reward, keeping the mean mutation rate at mutationRate
+  float quality_sum = 0.0f;
+  for (int op = 0; op < OPERATOR_COUNT; ++op) {
+    if (applications[op] > 0) {
+      operatorQuality[op] =
+          (1 - ADAPTATION_RATE) * operatorQuality[op] +
+          ADAPTATION_RATE * reward_sum[op] / applications[op];
+    }
+    if (op != CROSSOVER)
+      quality_sum += operatorQuality[op];
+  }
+  float mean_quality = quality_sum / (OPERATOR_COUNT - 1);
+  if (mean_quality <= 0.0f)
+    return;
+  for (int op = 0; op < OPERATOR_COUNT; ++op) {
+    float relative_quality = operatorQuality[op] / mean_quality;
+    if (op == CROSSOVER)
+      operatorRates[op] =
+          std::min(std::max(crossoverRate * relative_quality, 0.5f), 1.0f);
+    else
+      operatorRates[op] =
+          std::min(std::max(mutationRate * relative_quality, 0.05f), 0.9f);
+  }
+}
+
 float GeneticMelodyGenerator::fitness_repeated_short_notes(
-    const std::vector<int> &melody) {
+    const std::vector<int> &melody) const {
   int total_consecutive_short_notes = 0;
   int total_short_notes = 0;
   for (size_t i = 0; i < melody.size(); ++i) {
@@ -438,79 +783,45 @@ float GeneticMelodyGenerator::fitness_repeated_short_notes(
 }
 
 float GeneticMelodyGenerator::fitness_note_diversity(
-    const std::vector<int> &melody) {
+    const std::vector<int> &melody) const {
   int beat_length =
       static_cast<int>(meter.first / noteDuration * 4.0 / meter.second);
   int num_beats = melody.size() / beat_length;
   if (num_beats == 0)
     return 0.0;
 
-  std::vector<float> diversity_scores;
-
+  double diversity_sum = 0.0;
   for (int i = 0; i < num_beats; ++i) {
-    std::set<int> unique_notes;
-    for (int j = 0; j < beat_length; ++j) {
-      int index = i * beat_length + j;
-      if (melody[index] != -1 && melody[index] != -2) {
-        unique_notes.insert(melody[index]);
-      }
-    }
-    float diversity_score =
-        unique_notes.size() > 1
-            ? static_cast<float>(unique_notes.size()) / beat_length
-            : 0.0;
-    diversity_scores.push_back(diversity_score);
+    diversity_sum +=
+        measure_note_diversity(melody, i * beat_length, beat_length);
   }
 
-  float average_diversity =
-      std::accumulate(diversity_scores.begin(), diversity_scores.end(), 0.0) /
-      diversity_scores.size();
+  float average_diversity = diversity_sum / num_beats;
 
   return average_diversity;
 }
 
 float GeneticMelodyGenerator::fitness_diversity_intervals(
-    const std::vector<int> &melody) {
+    const std::vector<int> &melody) const {
   int beat_length =
       static_cast<int>(meter.first / noteDuration * 4.0 / meter.second);
   int num_beats = melody.size() / beat_length;
   if (num_beats == 0)
     return 0.0;
 
-  std::vector<float> diversity_scores;
-
+  double diversity_sum = 0.0;
   for (int i = 0; i < num_beats; ++i) {
-    std::vector<int> intervals;
-    std::set<int> unique_intervals;
-    for (int j = 1; j < beat_length; ++j) {
-      int index = i * beat_length + j;
-      if (melody[index] != -1 && melody[index] != -2 &&
-          melody[index - 1] != -1 && melody[index - 1] != -2) {
-        int interval = melody[index] - melody[index - 1];
-        if (std::abs(interval) <= 12) {
-          intervals.push_back(interval);
-        }
-      }
-    }
-    for (int interval : intervals) {
-      unique_intervals.insert(std::abs(interval));
-    }
-    float diversity_score =
-        unique_intervals.size() > 1
-            ? static_cast<float>(unique_intervals.size()) / intervals.size()
-            : 0.0;
-    diversity_scores.push_back(diversity_score);
+    diversity_sum +=
+        measure_interval_diversity(melody, i * beat_length, beat_length);
   }
 
-  float average_diversity =
-      std::accumulate(diversity_scores.begin(), diversity_scores.end(), 0.0) /
-      diversity_scores.size();
+  float average_diversity = diversity_sum / num_beats;
 
   return average_diversity;
 }
 
 float GeneticMelodyGenerator::fitness_pitch_variation(
-    const std::vector<int> &melody) {
+    const std::vector<int> &melody) const {
   std::vector<int> valid_notes;
   std::copy_if(melody.begin(), melody.end(), std::back_inserter(valid_notes),
                [](int note) { return note != -1 && note != -2; });
@@ -528,35 +839,15 @@ float GeneticMelodyGenerator::fitness_pitch_variation(
 }
 
 float GeneticMelodyGenerator::fitness_odd_index_notes(
-    const std::vector<int> &melody) {
+    const std::vector<int> &melody) const {
   int beat_length =
       static_cast<int>(meter.first / noteDuration * 4.0 / meter.second);
   int num_beats = melody.size() / beat_length;
   std::vector<float> odd_index_scores;
 
   for (int i = 0; i < num_beats; ++i) {
-    int note_and_extension_count = 0;
-    int beat_length_adjusted = 0;
-    for (int j = 1; j < beat_length; j += 2) {
-      if (melody[i * beat_length + j] > 0) {
-        note_and_extension_count++;
-        // Check for extensions of this note
-        int extension_idx = i * beat_length + j + 1;
-        while (extension_idx < (i + 1) * beat_length &&
-               melody[extension_idx] == -2) {
-          note_and_extension_count++;
-          extension_idx++;
-        }
-      }
-      beat_length_adjusted = beat_length - 2;
-    }
-
-    if (beat_length_adjusted > 0) {
-      odd_index_scores.push_back(static_cast<float>(note_and_extension_count) /
-                                 beat_length_adjusted);
-    } else {
-      odd_index_scores.push_back(0);
-    }
+    odd_index_scores.push_back(
+        measure_odd_index_notes(melody, i * beat_length, beat_length));
   }
 
   float average_odd_index_ratio =
@@ -568,31 +859,16 @@ float GeneticMelodyGenerator::fitness_odd_index_notes(
   return average_odd_index_ratio;
 }
 
-float GeneticMelodyGenerator::fitness_rhythm(const std::vector<int> &melody) {
+float GeneticMelodyGenerator::fitness_rhythm(
+    const std::vector<int> &melody) const {
   int beat_length =
       static_cast<int>(meter.first / noteDuration * 4.0 / meter.second);
   int num_beats = melody.size() / beat_length;
   std::vector<float> rhythmic_diversity_scores;
 
   for (int i = 0; i < num_beats; ++i) {
-    std::set<int> unique_lengths;
-    int current_length = 0;
-    for (int j = 0; j < beat_length; ++j) {
-      if (melody[i * beat_length + j] == -2) {
-        current_length += 1;
-      } else if (current_length > 0) {
-        unique_lengths.insert(current_length);
-        current_length = 0;
-      }
-    }
-    if (current_length > 0)
-      unique_lengths.insert(current_length);
-
-    float rhythmic_diversity_score =
-        unique_lengths.size() > 1
-            ? static_cast<float>(unique_lengths.size()) / unique_lengths.size()
-            : 0.0;
-    rhythmic_diversity_scores.push_back(rhythmic_diversity_score);
+    rhythmic_diversity_scores.push_back(
+        measure_rhythm_diversity(melody, i * beat_length, beat_length));
   }
 
   float average_rhythmic_diversity =
@@ -603,8 +879,85 @@ float GeneticMelodyGenerator::fitness_rhythm(const std::vector<int> &melody) {
   return average_rhythmic_diversity;
 }
 
+float GeneticMelodyGenerator::measure_note_diversity(
+    const std::vector<int> &melody, int start, int beat_length) const {
+  Bits::UniqueCounter<128> unique_notes; // MIDI notes
+  for (int j = 0; j < beat_length; ++j) {
+    int index = start + j;
+    if (melody[index] != -1 && melody[index] != -2) {
+      unique_notes.insert(melody[index]);
+    }
+  }
+  int unique_count = unique_notes.size();
+  return unique_count > 1 ? static_cast<float>(unique_count) / beat_length
+                          : 0.0f;
+}
+
+float GeneticMelodyGenerator::measure_interval_diversity(
+    const std::vector<int> &melody, int start, int beat_length) const {
+  int interval_count = 0;
+  Bits::UniqueCounter<13> unique_intervals; // interval classes 0..12
+  for (int j = 1; j < beat_length; ++j) {
+    int index = start + j;
+    if (melody[index] != -1 && melody[index] != -2 &&
+        melody[index - 1] != -1 && melody[index - 1] != -2) {
+      int interval = std::abs(melody[index] - melody[index - 1]);
+      if (interval <= 12) {
+        unique_intervals.insert(interval);
+        interval_count++;
+      }
+    }
+  }
+  int unique_count = unique_intervals.size();
+  return unique_count > 1 ? static_cast<float>(unique_count) / interval_count
+                          : 0.0f;
+}
+
+float GeneticMelodyGenerator::measure_rhythm_diversity(
+    const std::vector<int> &melody, int start, int beat_length) const {
+  std::set<int> unique_lengths;
+  int current_length = 0;
+  for (int j = 0; j < beat_length; ++j) {
+    if (melody[start + j] == -2) {
+      current_length += 1;
+    } else if (current_length > 0) {
+      unique_lengths.insert(current_length);
+      current_length = 0;
+    }
+  }
+  if (current_length > 0)
+    unique_lengths.insert(current_length);
+
+  return unique_lengths.size() > 1 ? static_cast<float>(unique_lengths.size()) /
+                                         unique_lengths.size()
+                                   : 0.0;
+}
+
+float GeneticMelodyGenerator::measure_odd_index_notes(
+    const std::vector<int> &melody, int start, int beat_length) const {
+  int note_and_extension_count = 0;
+  int beat_length_adjusted = 0;
+  for (int j = 1; j < beat_length; j += 2) {
+    if (melody[start + j] > 0) {
+      note_and_extension_count++;
+      // Check for extensions of this note
+      int extension_idx = start + j + 1;
+      while (extension_idx < start + beat_length &&
+             melody[extension_idx] == -2) {
+        note_and_extension_count++;
+        extension_idx++;
+      }
+    }
+    beat_length_adjusted = beat_length - 2;
+  }
+
+  if (beat_length_adjusted > 0)
+    return static_cast<float>(note_and_extension_count) / beat_length_adjusted;
+  return 0;
+}
+
 std::pair<float, float> GeneticMelodyGenerator::fitness_log_rhythmic_value(
-    const std::vector<int> &melody) {
+    const std::vector<int> &melody) const {
   std::vector<int> rhythmic_values;
   int start_index = -1;
   for (int i = 0; i < melody.size(); ++i) {
@@ -634,9 +987,9 @@ std::pair<float, float> GeneticMelodyGenerator::fitness_log_rhythmic_value(
   for (int value : rhythmic_values) {
     log_rhythmic_values.push_back(std::log2(value));
   }
-  if (rhythmic_values.empty()) {
-    std::cout << "\nEMPTY!!!!\n";
-  }
+  // An empty melody has no rhythm
+  if (rhythmic_values.empty())
+    return {0.0f, 0.0f};
 
   float average_rhythmic_value =
       std::accumulate(rhythmic_values.begin(), rhythmic_values.end(), 0.0) /
@@ -661,7 +1014,7 @@ std::pair<float, float> GeneticMelodyGenerator::fitness_log_rhythmic_value(
 }
 
 float GeneticMelodyGenerator::proportion_of_long_notes(
-    const std::vector<int> &melody) {
+    const std::vector<int> &melody) const {
   std::vector<int> rhythmic_values;
   int start_index = -1;
   for (int i = 0; i < melody.size(); ++i) {
@@ -690,7 +1043,7 @@ float GeneticMelodyGenerator::proportion_of_long_notes(
 }
 
 float GeneticMelodyGenerator::fitness_average_intervals(
-    const std::vector<int> &melody) {
+    const std::vector<int> &melody) const {
   std::vector<int> valid_notes;
   std::copy_if(melody.begin(), melody.end(), std::back_inserter(valid_notes),
                [](int note) { return note != -1 && note != -2; });
@@ -712,7 +1065,7 @@ float GeneticMelodyGenerator::fitness_average_intervals(
 }
 
 float GeneticMelodyGenerator::fitness_small_intervals(
-    const std::vector<int> &melody) {
+    const std::vector<int> &melody) const {
   std::vector<int> valid_notes;
   std::copy_if(melody.begin(), melody.end(), std::back_inserter(valid_notes),
                [](int note) { return note != -2; });
@@ -735,18 +1088,18 @@ float GeneticMelodyGenerator::fitness_small_intervals(
 }
 
 std::pair<float, float> GeneticMelodyGenerator::fitness_scale_and_chord(
-    const std::vector<int> &melody) {
+    const std::vector<int> &melody) const {
   int scale_length_counter = 0;
   int root_length_counter = 0;
   int total_length_counter = 0;
 
   for (int note : melody) {
+    // Pauses count into the total, but are never in the scale
     if (note != -2) {
-      if (std::find(scale_notes.begin(), scale_notes.end(), note % 12) !=
-          scale_notes.end()) {
+      if (in_scale(note)) {
         scale_length_counter++;
       }
-      if (note % 12 == scale_notes[0]) {
+      if (is_root(note)) {
         root_length_counter++;
       }
 
@@ -770,7 +1123,7 @@ std::pair<float, float> GeneticMelodyGenerator::fitness_scale_and_chord(
 }
 
 float GeneticMelodyGenerator::fitness_pause_proportion(
-    const std::vector<int> &melody) {
+    const std::vector<int> &melody) const {
   int total_length = static_cast<int>(melody.size());
 
   if (total_length == 0) {
@@ -796,7 +1149,7 @@ float GeneticMelodyGenerator::fitness_pause_proportion(
 }
 
 float GeneticMelodyGenerator::fitness_directional_changes(
-    const std::vector<int> &melody) {
+    const std::vector<int> &melody) const {
   std::vector<int> notes;
   for (int note : melody) {
     if (note != -1 && note != -2) {
@@ -843,7 +1196,7 @@ float GeneticMelodyGenerator::fitness_directional_changes(
 }
 
 float GeneticMelodyGenerator::fitness_melodic_contour(
-    const std::vector<int> &melody) {
+    const std::vector<int> &melody) const {
   std::vector<int> notes;
   std::copy_if(melody.begin(), melody.end(), std::back_inserter(notes),
                [](int note) { return note != -1 && note != -2; });
@@ -869,7 +1222,7 @@ float GeneticMelodyGenerator::fitness_melodic_contour(
 }
 
 float GeneticMelodyGenerator::fitness_note_range(
-    const std::vector<int> &melody) {
+    const std::vector<int> &melody) const {
   std::vector<int> notes;
   std::copy_if(melody.begin(), melody.end(), std::back_inserter(notes),
                [](int note) { return note != -1 && note != -2; });
@@ -883,7 +1236,7 @@ float GeneticMelodyGenerator::fitness_note_range(
 }
 
 float GeneticMelodyGenerator::fitness_average_pitch(
-    const std::vector<int> &melody) {
+    const std::vector<int> &melody) const {
   std::vector<int> valid_notes;
   std::copy_if(melody.begin(), melody.end(), std::back_inserter(valid_notes),
                [](int note) { return note != -1 && note != -2; });
@@ -897,7 +1250,8 @@ float GeneticMelodyGenerator::fitness_average_pitch(
 }
 
 std::pair<float, float>
-GeneticMelodyGenerator::fitness_intervals(const std::vector<int> &melody) {
+GeneticMelodyGenerator::fitness_intervals(
+    const std::vector<int> &melody) const {
   float dissonance_score = 0.0;
   float large_intervals_score = 0.0;
   std::vector<int> intervals;
@@ -948,9 +1302,282 @@ GeneticMelodyGenerator::fitness_intervals(const std::vector<int> &melody) {
   return {dissonance_score, large_intervals_score};
 }
 
+bool GeneticMelodyGenerator::build_rhythm_boards(const std::vector<int> &melody,
+                                                 RhythmBoards &rhythm) const {
+  int beat_length =
+      static_cast<int>(meter.first / noteDuration * 4.0 / meter.second);
+  int length = static_cast<int>(melody.size());
+  if (beat_length <= 0 || beat_length > 64)
+    return false;
+  int measures = (length + beat_length - 1) / beat_length;
+  if (measures > MAX_BOARD_MEASURES)
+    return false;
+
+  rhythm.length = length;
+  rhythm.stepsPerMeasure = beat_length;
+  rhythm.measures = measures;
+  rhythm.noteCount = 0;
+  rhythm.pauseCount = 0;
+  rhythm.constantPitch = true;
+  rhythm.pitch = -1;
+  for (int i = 0; i < measures; ++i) {
+    MeasureBoard &board = rhythm.boards[i];
+    board = {0, 0, 0, 0};
+    int steps = std::min(beat_length, length - i * beat_length);
+    for (int j = 0; j < steps; ++j) {
+      int note = melody[i * beat_length + j];
+      uint64_t bit = uint64_t(1) << j;
+      if (note == -2) {
+        board.extensions |= bit;
+      } else if (note == -1) {
+        board.pauses |= bit;
+        rhythm.pauseCount++;
+      } else {
+        board.notes |= bit;
+        if (note == 0)
+          board.zeroPitch |= bit;
+        if (rhythm.noteCount == 0)
+          rhythm.pitch = note;
+        else if (note != rhythm.pitch)
+          rhythm.constantPitch = false;
+        rhythm.noteCount++;
+      }
+    }
+  }
+  return true;
+}
+
+// Calls f with the length of every run of extensions in the melody, in order.
+// Unlike the per-measure features, runs continue over the bar lines.
+template <typename Boards, typename F>
+static void for_each_extension_run(const Boards &rhythm, F f) {
+  int open_run = 0; // run reaching the end of the previous measure
+  for (int i = 0; i < rhythm.measures; ++i) {
+    uint64_t extensions = rhythm.boards[i].extensions;
+    int steps = std::min(rhythm.stepsPerMeasure,
+                         rhythm.length - i * rhythm.stepsPerMeasure);
+    if (open_run > 0 && !(extensions & 1)) {
+      f(open_run);
+      open_run = 0;
+    }
+    while (extensions) {
+      int start = Bits::countTrailingZeros(extensions);
+      int run = Bits::countTrailingOnes(extensions >> start);
+      extensions = Bits::clearLowestRun(extensions);
+      bool reaches_end = start + run == steps;
+      if (start == 0) {
+        run += open_run;
+        open_run = 0;
+      }
+      if (reaches_end && i + 1 < rhythm.measures)
+        open_run = run;
+      else
+        f(run);
+    }
+  }
+  if (open_run > 0)
+    f(open_run);
+}
+
+float GeneticMelodyGenerator::rhythm_diversity_bits(
+    const RhythmBoards &rhythm) const {
+  int num_beats = rhythm.length / rhythm.stepsPerMeasure;
+  double diversity_sum = 0.0;
+  for (int i = 0; i < num_beats; ++i) {
+    // Value n - 1 stands for a run of n extensions
+    Bits::UniqueCounter<64> run_lengths;
+    uint64_t extensions = rhythm.boards[i].extensions;
+    while (extensions) {
+      int start = Bits::countTrailingZeros(extensions);
+      run_lengths.insert(Bits::countTrailingOnes(extensions >> start) - 1);
+      extensions = Bits::clearLowestRun(extensions);
+    }
+    int unique_lengths = run_lengths.size();
+    diversity_sum += unique_lengths > 1 ? static_cast<float>(unique_lengths) /
+                                              unique_lengths
+                                        : 0.0f;
+  }
+  // 0 / 0 for melodies shorter than a measure, like the scalar version
+  return diversity_sum / num_beats;
+}
+
+float GeneticMelodyGenerator::odd_index_notes_bits(
+    const RhythmBoards &rhythm) const {
+  const uint64_t odd_steps = 0xAAAAAAAAAAAAAAAAull;
+  int beat_length = rhythm.stepsPerMeasure;
+  int num_beats = rhythm.length / beat_length;
+  if (num_beats == 0)
+    return 0.0;
+
+  int beat_length_adjusted = beat_length > 1 ? beat_length - 2 : 0;
+  double score_sum = 0.0;
+  for (int i = 0; i < num_beats; ++i) {
+    const MeasureBoard &board = rhythm.boards[i];
+    uint64_t odd_notes = board.notes & ~board.zeroPitch & odd_steps &
+                         Bits::lowMask(beat_length);
+    // Extensions held from the odd notes, up to the end of the measure
+    uint64_t held = Bits::fillRuns(board.extensions,
+                                   (odd_notes << 1) & board.extensions);
+    int note_and_extension_count =
+        Bits::popcount(odd_notes) + Bits::popcount(held);
+    score_sum += beat_length_adjusted > 0
+                     ? static_cast<float>(note_and_extension_count) /
+                           beat_length_adjusted
+                     : 0.0f;
+  }
+  return score_sum / num_beats;
+}
+
+float GeneticMelodyGenerator::pause_proportion_bits(
+    const RhythmBoards &rhythm) const {
+  if (rhythm.length == 0)
+    return 0.0;
+
+  int pause_length_counter = 0;
+  uint64_t carry = 0; // the previous measure ended inside a pause
+  for (int i = 0; i < rhythm.measures; ++i) {
+    const MeasureBoard &board = rhythm.boards[i];
+    int steps = std::min(rhythm.stepsPerMeasure,
+                         rhythm.length - i * rhythm.stepsPerMeasure);
+    uint64_t held = Bits::fillRuns(
+        board.extensions, ((board.pauses << 1) | carry) & board.extensions);
+    uint64_t paused = board.pauses | held;
+    pause_length_counter += Bits::popcount(paused);
+    carry = (paused >> (steps - 1)) & 1;
+  }
+  return static_cast<float>(pause_length_counter) / rhythm.length;
+}
+
+std::pair<float, float> GeneticMelodyGenerator::log_rhythmic_value_bits(
+    const RhythmBoards &rhythm) const {
+  // Sums in the same order and precision as fitness_log_rhythmic_value: the
+  // extended notes first, then the single notes (log2(1) = 0)
+  double value_sum = 0.0;
+  double log_sq_sum = 0.0;
+  size_t value_count = 0;
+  int extension_count = 0;
+  for_each_extension_run(rhythm, [&](int run) {
+    int value = run + 1;
+    float log_value = std::log2(value);
+    value_sum += value;
+    log_sq_sum += log_value * log_value;
+    value_count++;
+    extension_count += run;
+  });
+  int single_notes = rhythm.length - extension_count;
+  value_sum += single_notes;
+  value_count += single_notes;
+  if (value_count == 0)
+    return {0.0f, 0.0f};
+
+  float average_rhythmic_value = value_sum / value_count;
+  float log_average_rhythmic_value = std::log2(average_rhythmic_value);
+
+  float normalized_log_rhythmic_value =
+      (log_average_rhythmic_value - std::log2(1)) /
+      (std::log2(4 * expectedLength) - std::log2(1));
+
+  float sq_sum_log = log_sq_sum;
+  float stdev_log =
+      std::sqrt(sq_sum_log / value_count -
+                log_average_rhythmic_value * log_average_rhythmic_value);
+
+  float normalized_std_log_rhythmic_value =
+      stdev_log / std::log2(4 * expectedLength);
+
+  return {normalized_log_rhythmic_value, normalized_std_log_rhythmic_value};
+}
+
+float GeneticMelodyGenerator::proportion_of_long_notes_bits(
+    const RhythmBoards &rhythm) const {
+  int long_notes_count = 0;
+  int value_count = 0;
+  int extension_count = 0;
+  for_each_extension_run(rhythm, [&](int run) {
+    if (run + 1 > 4)
+      long_notes_count++;
+    value_count++;
+    extension_count += run;
+  });
+  value_count += rhythm.length - extension_count;
+  return long_notes_count / static_cast<float>(value_count);
+}
+
+void GeneticMelodyGenerator::constant_pitch_features(
+    const std::vector<int> &melody, const RhythmBoards &rhythm,
+    FeatureVector &features) const {
+  int note_count = rhythm.noteCount;
+  int pitch = rhythm.pitch;
+  size_t n = note_count;
+
+  // Every interval is a unison
+  features[DIVERSITY] = 0.0;
+  features[DIVERSITY_INTERVAL] = 0.0;
+  features[DISSONANCE] = 0.0;
+  features[LARGE_INTERVALS] = 0.0;
+  features[MELODIC_CONTOUR] = note_count < 2 ? 0.0 : 0.5;
+  features[AVERAGE_INTERVAL] = note_count < 2 ? -1.0 : 0.0;
+  features[PITCH_RANGE] = 0.0;
+
+  // Pauses count into the total, extensions don't
+  int total_length_counter = note_count + rhythm.pauseCount;
+  bool pitch_in_scale = note_count > 0 && in_scale(pitch);
+  bool pitch_is_root = note_count > 0 && is_root(pitch);
+  features[SCALE_CONFORMANCE] =
+      total_length_counter == 0
+          ? 0.0f
+          : static_cast<float>(pitch_in_scale ? note_count : 0) /
+                total_length_counter;
+  features[ROOT_CONFORMANCE] =
+      total_length_counter == 0
+          ? 0.0f
+          : static_cast<float>(pitch_is_root ? note_count : 0) /
+                total_length_counter;
+
+  // Same expressions as fitness_average_pitch and fitness_pitch_variation, the
+  // sums of integers are exact in double
+  if (note_count == 0) {
+    features[AVERAGE_PITCH] = 0.0;
+  } else {
+    float sum = static_cast<double>(pitch) * note_count;
+    float average_pitch = sum / n;
+    features[AVERAGE_PITCH] = average_pitch / notesRange;
+  }
+  if (note_count < 2) {
+    features[PITCH_VARIATION] = 0.0;
+  } else {
+    float mean = static_cast<double>(pitch) * note_count / n;
+    float sq_sum = static_cast<double>(pitch * pitch) * note_count;
+    float stdev = std::sqrt(sq_sum / n - mean * mean);
+    float max_possible_std = notesRange / std::sqrt(12.0);
+    features[PITCH_VARIATION] = stdev / max_possible_std;
+  }
+
+  // The steps between a note and a pause are only small for pitches up to 2,
+  // and the unisons between two notes or two pauses never count
+  if (note_count > 0 && pitch <= 2)
+    features[SCALE_PLAYING] = fitness_small_intervals(melody);
+  else
+    features[SCALE_PLAYING] = 0.0;
+
+  // Notes directly following a note
+  int consecutive_notes = 0;
+  uint64_t carry = 0;
+  for (int i = 0; i < rhythm.measures; ++i) {
+    uint64_t notes = rhythm.boards[i].notes;
+    int steps = std::min(rhythm.stepsPerMeasure,
+                         rhythm.length - i * rhythm.stepsPerMeasure);
+    consecutive_notes += Bits::popcount(notes & ((notes << 1) | carry));
+    carry = (notes >> (steps - 1)) & 1;
+  }
+  features[SHORT_CONSECUTIVE_NOTES] =
+      note_count == 0 ? 0.0f
+                      : static_cast<float>(consecutive_notes) / note_count;
+}
+
 float GeneticMelodyGenerator::calculate_similarity_penalty(
     const std::vector<int> &melody,
-    const std::vector<std::vector<int>> &population) {
+    const std::vector<std::vector<int>> &population) const {
   int total_similarity = 0;
   int total_notes = (melody.size() - 1) * (population.size() - 1);
 
@@ -969,63 +1596,76 @@ float GeneticMelodyGenerator::calculate_similarity_penalty(
   return 0.0f;
 }
 
-float GeneticMelodyGenerator::fitness(
-    const std::vector<int> &melody,
-    const std::vector<std::vector<int>> &population) {
-  // Scores from individual fitness functions
-  std::pair<float, float> intervals_score = fitness_intervals(melody);
-  std::pair<float, float> scale_chord_score = fitness_scale_and_chord(melody);
-  float pause_proportion_score = fitness_pause_proportion(melody);
-  float diversity_score = fitness_note_diversity(melody);
-  float diversity_interval_score = fitness_diversity_intervals(melody);
-  float rhythmic_diversity_score = fitness_rhythm(melody);
-  float melodic_contour_score = fitness_melodic_contour(melody);
-  float pitch_range_score = fitness_note_range(melody);
-  float average_pitch_score = fitness_average_pitch(melody);
-  float pitch_variation_score = fitness_pitch_variation(melody);
-  float odd_index_notes_score = fitness_odd_index_notes(melody);
-  float average_interval_score = fitness_average_intervals(melody);
-  float scale_playing_score = fitness_small_intervals(melody);
-  float short_consecutive_score = fitness_repeated_short_notes(melody);
-  std::pair<float, float> log_rhythmic_values =
-      fitness_log_rhythmic_value(melody);
+GeneticMelodyGenerator::FeatureVector
+GeneticMelodyGenerator::extract_features(const std::vector<int> &melody) const {
+  FeatureVector features;
+  RhythmBoards rhythm;
+  bool has_boards = TRACE_CALL(build_rhythm_boards, melody, rhythm);
 
-  // Calculate overall fitness
-  float fitness_value = 0.0;
-  std::map<std::string, float> scores = {
-      {"diversity", diversity_score},
-      {"diversity_interval", diversity_interval_score},
-      {"dissonance", intervals_score.first},
-      {"rhythmic_diversity", rhythmic_diversity_score},
-      {"rhythmic_average_value", log_rhythmic_values.first},
-      {"deviation_rhythmic_value", 0.0},
-      // {"deviation_rhythmic_value", log_rhythmic_values.second},
-      {"scale_conformance", scale_chord_score.first},
-      {"root_conformance", scale_chord_score.second},
-      {"melodic_contour", melodic_contour_score},
-      {"pitch_range", pitch_range_score},
-      {"pause_proportion", pause_proportion_score},
-      {"large_intervals", intervals_score.second},
-      {"average_pitch", average_pitch_score},
-      {"pitch_variation", pitch_variation_score},
-      {"odd_index_notes", odd_index_notes_score},
-      {"average_interval", average_interval_score},
-      {"scale_playing", scale_playing_score},
-      {"short_consecutive_notes", short_consecutive_score},
-  };
+  // Pitch features
+  if (has_boards && rhythm.constantPitch) {
+    TRACE_SCOPE("constant_pitch_features");
+    constant_pitch_features(melody, rhythm, features);
+  } else {
+    std::pair<float, float> intervals_score =
+        TRACE_CALL(fitness_intervals, melody);
+    std::pair<float, float> scale_chord_score =
+        TRACE_CALL(fitness_scale_and_chord, melody);
+    features[DIVERSITY] = TRACE_CALL(fitness_note_diversity, melody);
+    features[DIVERSITY_INTERVAL] =
+        TRACE_CALL(fitness_diversity_intervals, melody);
+    features[DISSONANCE] = intervals_score.first;
+    features[SCALE_CONFORMANCE] = scale_chord_score.first;
+    features[ROOT_CONFORMANCE] = scale_chord_score.second;
+    features[MELODIC_CONTOUR] = TRACE_CALL(fitness_melodic_contour, melody);
+    features[PITCH_RANGE] = TRACE_CALL(fitness_note_range, melody);
+    features[LARGE_INTERVALS] = intervals_score.second;
+    features[AVERAGE_PITCH] = TRACE_CALL(fitness_average_pitch, melody);
+    features[PITCH_VARIATION] = TRACE_CALL(fitness_pitch_variation, melody);
+    features[AVERAGE_INTERVAL] = TRACE_CALL(fitness_average_intervals, melody);
+    features[SCALE_PLAYING] = TRACE_CALL(fitness_small_intervals, melody);
+    features[SHORT_CONSECUTIVE_NOTES] =
+        TRACE_CALL(fitness_repeated_short_notes, melody);
+  }
+
+  // Rhythm features
+  std::pair<float, float> log_rhythmic_values;
+  if (has_boards) {
+    log_rhythmic_values = TRACE_CALL(log_rhythmic_value_bits, rhythm);
+    features[RHYTHMIC_DIVERSITY] = TRACE_CALL(rhythm_diversity_bits, rhythm);
+    features[PAUSE_PROPORTION] = TRACE_CALL(pause_proportion_bits, rhythm);
+    features[ODD_INDEX_NOTES] = TRACE_CALL(odd_index_notes_bits, rhythm);
+  } else {
+    log_rhythmic_values = TRACE_CALL(fitness_log_rhythmic_value, melody);
+    features[RHYTHMIC_DIVERSITY] = TRACE_CALL(fitness_rhythm, melody);
+    features[PAUSE_PROPORTION] = TRACE_CALL(fitness_pause_proportion, melody);
+    features[ODD_INDEX_NOTES] = TRACE_CALL(fitness_odd_index_notes, melody);
+  }
+  features[RHYTHMIC_AVERAGE_VALUE] = log_rhythmic_values.first;
+  features[DEVIATION_RHYTHMIC_VALUE] = 0.0;
+  // features[DEVIATION_RHYTHMIC_VALUE] = log_rhythmic_values.second;
+  return features;
+}
 
-  for (const std::pair<const std::string, float> &score_pair : scores) {
-    const std::string &feature = score_pair.first;
-    float score = score_pair.second;
-    if (muValues.find(feature) != muValues.end() &&
-        sigmaValues.find(feature) != sigmaValues.end() &&
-        weights.find(feature) != weights.end()) {
-      fitness_value += weights[feature] *
-                       std::exp(-0.5 * std::pow((score - muValues[feature]) /
-                                                    sigmaValues[feature],
-                                                2));
+float GeneticMelodyGenerator::score_features(
+    const FeatureVector &features) const {
+  float fitness_value = 0.0;
+  for (int i = 0; i < FEATURE_COUNT; ++i) {
+    if (featureEnabled[i]) {
+      fitness_value +=
+          featureWeight[i] *
+          std::exp(-0.5 *
+                   std::pow((features[i] - featureMu[i]) / featureSigma[i], 2));
     }
   }
+  return fitness_value;
+}
+
+float GeneticMelodyGenerator::fitness(
+    const std::vector<int> &melody,
+    const std::vector<std::vector<int>> &population) {
+  // Calculate overall fitness
+  float fitness_value = score_features(extract_features(melody));
   int similarity_weight = 10;
   float similarity_penalty = calculate_similarity_penalty(melody, population);
 
@@ -1033,148 +1673,593 @@ float GeneticMelodyGenerator::fitness(
   return fitness_value;
 }
 
-std::vector<std::vector<int>>
-GeneticMelodyGenerator::run(float measures,
-                            const std::vector<int> &template_individual) {
-  int note_amount = static_cast<int>(meter.first / noteDuration * 4.0 /
-                                     meter.second * measures);
-  std::vector<std::vector<int>> population;
-  if (mode == 0) {
-    population = generate_population(note_amount);
-  } else if (mode == 1) {
-    population = generate_population_fixed(note_amount);
-  } else if (mode == 2) {
-    population = generate_population_from_template(template_individual);
+std::vector<float> GeneticMelodyGenerator::evaluate_population(
+    const std::vector<std::vector<int>> &population,
+    std::vector<FeatureVector> &features, std::vector<float> &similarity) {
+  TRACE_SCOPE("evaluation");
+  int similarity_weight = 10;
+  features.resize(population.size());
+  similarity.resize(population.size());
+  std::vector<float> scores(population.size());
+  for (size_t i = 0; i < population.size(); ++i) {
+    features[i] = extract_features(population[i]);
+    similarity[i] =
+        TRACE_CALL(calculate_similarity_penalty, population[i], population);
+    scores[i] = score_features(features[i]) - similarity[i] * similarity_weight;
   }
-  std::vector<std::vector<int>> new_population;
-  int POPULATION_SIZE = 128;
-  int NUM_GENERATIONS = 100;
-  float CROSSOVER_RATE = 0.9;
-  new_population.reserve(POPULATION_SIZE);
+  return scores;
+}
 
-  for (int generation = 0; generation < NUM_GENERATIONS; ++generation) {
-    std::cout << "Generation " << generation + 1 << "/" << NUM_GENERATIONS
-              << '\n';
-    new_population.clear();
+std::vector<int>
+GeneticMelodyGenerator::rank_population(const std::vector<float> &scores,
+                                        int count) const {
+  TRACE_SCOPE("ranking");
+  // Sort the population by fitness in descending order
+  std::vector<int> order(scores.size());
+  std::iota(order.begin(), order.end(), 0);
+  count = std::min(count, static_cast<int>(scores.size()));
+  std::partial_sort(order.begin(), order.begin() + count, order.end(),
+                    [&scores](int a, int b) { return scores[a] > scores[b]; });
+  order.resize(count);
+  return order;
+}
 
-    while (new_population.size() < POPULATION_SIZE) {
-      std::vector<int> parent1 = tournament_selection(population);
-      std::vector<int> parent2 = tournament_selection(population);
-      std::vector<int> child1, child2;
+std::vector<std::vector<int>> GeneticMelodyGenerator::top_melodies(
+    const std::vector<std::vector<int>> &population,
+    const std::vector<float> &scores, int count) const {
+  std::vector<std::vector<int>> best_melodies;
+  for (int index : rank_population(scores, count)) {
+    best_melodies.push_back(population[index]);
+  }
+  return best_melodies;
+}
 
-      if (prob_dist(rng) < CROSSOVER_RATE && !parent1.empty() &&
-          !parent2.empty()) {
-        std::tie(child1, child2) = crossover(parent1, parent2);
-      } else {
-        child1 = parent1;
-        child2 = parent2;
+void GeneticMelodyGenerator::set_local_search(float time_budget_ms) {
+  localSearchBudgetMs = std::max(time_budget_ms, 0.0f);
+}
+
+std::vector<std::vector<int>>
+GeneticMelodyGenerator::polish(const std::vector<std::vector<int>> &population,
+                               const std::vector<int> &indices) const {
+  TRACE_SCOPE("local_search");
+  // How many melodies of the population have a value at each position, so
+  // that the similarity penalty of a single-note change costs O(1)
+  std::vector<int> similarity_counts(population.empty()
+                                         ? 0
+                                         : population[0].size() *
+                                               SIMILARITY_VALUES,
+                                     0);
+  for (const auto &other : population) {
+    for (size_t i = 0; i < other.size(); ++i) {
+      if (other[i] >= -2 && other[i] < SIMILARITY_VALUES - 2 &&
+          i * SIMILARITY_VALUES < similarity_counts.size())
+        similarity_counts[i * SIMILARITY_VALUES + other[i] + 2]++;
+    }
+  }
+
+  std::vector<std::vector<int>> melodies;
+  for (int index : indices) {
+    melodies.push_back(population[index]);
+  }
+  std::vector<float> scores(melodies.size());
+
+  // Every melody climbs on its own worker until the time budget runs out
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::microseconds(
+                      static_cast<long long>(localSearchBudgetMs * 1000));
+  if (!polishWorkers || polishWorkers->size() < melodies.size())
+    polishWorkers = std::make_unique<WorkerPool>(melodies.size());
+  polishWorkers->run(melodies.size(), [&](size_t k) {
+    Trace::setThreadName("local search");
+    TRACE_SCOPE("hill_climb");
+    scores[k] = hill_climb(melodies[k], indices[k], population,
+                           similarity_counts, deadline);
+  });
+
+  std::vector<std::vector<int>> polished;
+  for (int index : rank_population(scores, melodies.size())) {
+    polished.push_back(std::move(melodies[index]));
+  }
+  return polished;
+}
+
+void GeneticMelodyGenerator::add_window_terms(const std::vector<int> &melody,
+                                              size_t first, size_t last,
+                                              int sign,
+                                              FeatureSums &sums) const {
+  int previous_note = -1; // in the window
+  int sounding_count = 0;
+  int sounding_before = 0; // the two notes or pauses before this one
+  int sounding_last = 0;
+  // first is the start of the melody or a note or pause, which decides
+  // alone whether it is paused
+  bool in_pause = false;
+  for (size_t j = first; j <= last; ++j) {
+    int note = melody[j];
+    if (note == -2) {
+      sums.extensions += sign;
+      if (j == 0 || melody[j - 1] != -2)
+        sums.extensionRuns += sign;
+      if (in_pause)
+        sums.pausedSteps += sign;
+      continue;
+    }
+    in_pause = note == -1;
+    if (in_pause)
+      sums.pausedSteps += sign;
+
+    sums.sounding += sign;
+    if (in_scale(note))
+      sums.inScale += sign;
+    if (is_root(note))
+      sums.roots += sign;
+    if (sounding_count >= 2) {
+      int interval1 = sounding_last - sounding_before;
+      int interval2 = note - sounding_last;
+      if (std::abs(interval1) <= 3 && std::abs(interval2) <= 3 &&
+          interval1 * interval2 != 0)
+        sums.smallIntervalPairs += sign;
+    }
+    sounding_before = sounding_last;
+    sounding_last = note;
+    sounding_count++;
+    if (note < 0)
+      continue;
+
+    sums.notes += sign;
+    sums.pitchSum += sign * note;
+    sums.pitchSqSum += sign * note * note;
+    sums.pitchCounts[note] += sign;
+    if (j > first && melody[j - 1] >= 0 && note - melody[j - 1] <= 2)
+      sums.shortRepeats += sign;
+    if (previous_note >= 0) {
+      int interval = note - previous_note;
+      int distance = std::abs(interval);
+      sums.intervals += sign;
+      if (distance > 12)
+        sums.largeIntervals += sign;
+      if (distance % 12 == 10)
+        sums.dissonance += sign;
+      else if (distance % 12 == 6 || distance % 12 == 11)
+        sums.dissonance += 2 * sign;
+      if (interval > 0)
+        sums.risingIntervals += sign;
+      if (interval != 0)
+        sums.movingIntervals += sign;
+      if (distance <= 12) {
+        sums.steps += sign;
+        sums.stepSum += sign * distance;
       }
+    }
+    previous_note = note;
+  }
+}
 
-      mutate(child1);
-      mutate(child2);
-      new_population.push_back(std::move(child1));
-      new_population.push_back(std::move(child2));
+GeneticMelodyGenerator::MeasureTerms
+GeneticMelodyGenerator::measure_terms(const std::vector<int> &melody,
+                                      int start, int beat_length) const {
+  return {measure_note_diversity(melody, start, beat_length),
+          measure_interval_diversity(melody, start, beat_length),
+          measure_rhythm_diversity(melody, start, beat_length),
+          measure_odd_index_notes(melody, start, beat_length)};
+}
+
+void GeneticMelodyGenerator::init_feature_sums(const std::vector<int> &melody,
+                                               FeatureSums &sums) const {
+  std::vector<MeasureTerms> measures = std::move(sums.measures);
+  sums = {};
+  sums.length = static_cast<int>(melody.size());
+  sums.beatLength =
+      static_cast<int>(meter.first / noteDuration * 4.0 / meter.second);
+  if (!melody.empty())
+    add_window_terms(melody, 0, melody.size() - 1, 1, sums);
+  measures.clear();
+  for (int i = 0; i < sums.length / sums.beatLength; ++i) {
+    measures.push_back(
+        measure_terms(melody, i * sums.beatLength, sums.beatLength));
+  }
+  sums.measures = std::move(measures);
+}
+
+void GeneticMelodyGenerator::change_note(std::vector<int> &melody, size_t i,
+                                         int value, FeatureSums &sums) const {
+  // Every term the change can alter lies within the window: two notes or
+  // pauses and a note on either side of i (the last intervals and the pairs
+  // of intervals around it), or the end of the melody. The paused steps
+  // after the window depend only on its last note or pause.
+  size_t first = 0;
+  int sounding = 0;
+  bool note = false;
+  for (size_t j = i; j-- > 0;) {
+    sounding += melody[j] != -2;
+    note = note || melody[j] >= 0;
+    if (sounding >= 2 && note) {
+      first = j;
+      break;
     }
+  }
+  size_t last = melody.size() - 1;
+  sounding = 0;
+  note = false;
+  for (size_t j = i + 1; j < melody.size(); ++j) {
+    sounding += melody[j] != -2;
+    note = note || melody[j] >= 0;
+    if (sounding >= 2 && note) {
+      last = j;
+      break;
+    }
+  }
 
-    population = std::move(new_population);
+  add_window_terms(melody, first, last, -1, sums);
+  melody[i] = value;
+  add_window_terms(melody, first, last, 1, sums);
+  size_t measure = i / sums.beatLength;
+  if (measure < sums.measures.size())
+    sums.measures[measure] =
+        measure_terms(melody, measure * sums.beatLength, sums.beatLength);
+}
+
+GeneticMelodyGenerator::FeatureVector
+GeneticMelodyGenerator::features_from_sums(const FeatureSums &sums) const {
+  // The expressions of the scalar features, on the same counts
+  FeatureVector features;
+  int num_beats = static_cast<int>(sums.measures.size());
+  double note_diversity = 0.0;
+  double interval_diversity = 0.0;
+  double rhythm_diversity = 0.0;
+  double odd_index_notes = 0.0;
+  for (const MeasureTerms &terms : sums.measures) {
+    note_diversity += terms.noteDiversity;
+    interval_diversity += terms.intervalDiversity;
+    rhythm_diversity += terms.rhythmDiversity;
+    odd_index_notes += terms.oddIndexNotes;
   }
+  features[DIVERSITY] =
+      num_beats == 0 ? 0.0f : static_cast<float>(note_diversity / num_beats);
+  features[DIVERSITY_INTERVAL] =
+      num_beats == 0 ? 0.0f
+                     : static_cast<float>(interval_diversity / num_beats);
+  // 0 / 0 for melodies shorter than a measure, like fitness_rhythm
+  features[RHYTHMIC_DIVERSITY] = rhythm_diversity / num_beats;
+  features[ODD_INDEX_NOTES] =
+      num_beats == 0 ? 0.0f : static_cast<float>(odd_index_notes / num_beats);
+
+  int notes = sums.notes;
+  features[DISSONANCE] =
+      sums.intervals == 0
+          ? 0.0f
+          : static_cast<float>(sums.dissonance) / sums.intervals;
+  features[LARGE_INTERVALS] =
+      sums.intervals == 0
+          ? 0.0f
+          : static_cast<float>(sums.largeIntervals) / sums.intervals;
+  features[SCALE_CONFORMANCE] =
+      sums.sounding == 0 ? 0.0f
+                         : static_cast<float>(sums.inScale) / sums.sounding;
+  features[ROOT_CONFORMANCE] =
+      sums.sounding == 0 ? 0.0f
+                         : static_cast<float>(sums.roots) / sums.sounding;
+  if (notes < 2)
+    features[MELODIC_CONTOUR] = 0.0f;
+  else if (sums.movingIntervals == 0)
+    features[MELODIC_CONTOUR] = 0.5f;
+  else
+    features[MELODIC_CONTOUR] =
+        static_cast<float>(sums.risingIntervals) / sums.movingIntervals;
+
+  if (notes == 0) {
+    features[PITCH_RANGE] = 0.0f;
+    features[AVERAGE_PITCH] = 0.0f;
+  } else {
+    int lowest = 0;
+    while (sums.pitchCounts[lowest] == 0)
+      lowest++;
+    int highest = static_cast<int>(sums.pitchCounts.size()) - 1;
+    while (sums.pitchCounts[highest] == 0)
+      highest--;
+    features[PITCH_RANGE] = static_cast<float>(highest - lowest) / notesRange;
+    float sum = static_cast<double>(sums.pitchSum);
+    float average_pitch = sum / notes;
+    features[AVERAGE_PITCH] = average_pitch / notesRange;
+  }
+  if (notes < 2) {
+    features[PITCH_VARIATION] = 0.0f;
+  } else {
+    float mean = static_cast<double>(sums.pitchSum) / notes;
+    float sq_sum = static_cast<double>(sums.pitchSqSum);
+    float stdev = std::sqrt(sq_sum / notes - mean * mean);
+    float max_possible_std = notesRange / std::sqrt(12.0);
+    features[PITCH_VARIATION] = stdev / max_possible_std;
+  }
+  if (notes < 2 || sums.steps == 0) {
+    features[AVERAGE_INTERVAL] = -1.0f;
+  } else {
+    float sum = static_cast<float>(sums.stepSum);
+    float average_interval = sum / sums.steps;
+    features[AVERAGE_INTERVAL] = average_interval / 12.0;
+  }
+  features[SCALE_PLAYING] =
+      sums.sounding < 2
+          ? 0.0f
+          : sums.smallIntervalPairs / static_cast<float>(sums.sounding - 1);
+  features[SHORT_CONSECUTIVE_NOTES] =
+      notes == 0 ? 0.0f : static_cast<float>(sums.shortRepeats) / notes;
+
+  features[PAUSE_PROPORTION] =
+      sums.length == 0 ? 0.0f
+                       : static_cast<float>(sums.pausedSteps) / sums.length;
+  // Every run of extensions is one value (its length + 1), every other step
+  // a value of 1
+  int value_count = sums.extensionRuns + sums.length - sums.extensions;
+  if (value_count == 0) {
+    features[RHYTHMIC_AVERAGE_VALUE] = 0.0f;
+  } else {
+    float average_rhythmic_value =
+        static_cast<double>(sums.length + sums.extensionRuns) / value_count;
+    float log_average_rhythmic_value = std::log2(average_rhythmic_value);
+    features[RHYTHMIC_AVERAGE_VALUE] =
+        (log_average_rhythmic_value - std::log2(1)) /
+        (std::log2(4 * expectedLength) - std::log2(1));
+  }
+  features[DEVIATION_RHYTHMIC_VALUE] = 0.0;
+  return features;
+}
 
-  // Sort the population by fitness in descending order
-  std::sort(population.begin(), population.end(),
-            [this, &population](const std::vector<int> &a,
-                                const std::vector<int> &b) {
-              return fitness(a, population) > fitness(b, population);
-            });
+float GeneticMelodyGenerator::hill_climb(
+    std::vector<int> &melody, int self_index,
+    const std::vector<std::vector<int>> &population,
+    const std::vector<int> &similarity_counts,
+    std::chrono::steady_clock::time_point deadline) const {
+  int similarity_weight = 10;
+  const std::vector<int> &self = population[self_index];
+  int total_notes = (melody.size() - 1) * (population.size() - 1);
 
-  // Collect the top 12 best melodies
-  std::vector<std::vector<int>> best_melodies;
-  int count = std::min(
-      12,
-      static_cast<int>(population.size())); // Ensure there are enough melodies
-  for (int i = 0; i < count; ++i) {
-    best_melodies.push_back(population[i]);
+  // Matches of value at position i with the rest of the population
+  auto similarity_at = [&](size_t i, int value) {
+    if (i == 0 || value < -2 || value >= SIMILARITY_VALUES - 2)
+      return 0;
+    return similarity_counts[i * SIMILARITY_VALUES + value + 2] -
+           (self[i] == value ? 1 : 0);
+  };
+  // The features follow the changes through their sums
+  FeatureSums sums;
+  init_feature_sums(melody, sums);
+  auto melody_fitness = [&](int similarity) {
+    float similarity_penalty =
+        total_notes > 0 ? static_cast<float>(similarity) / total_notes : 0.0f;
+    return score_features(features_from_sums(sums)) -
+           similarity_penalty * similarity_weight;
+  };
+  // Changes that repair() would undo break the hard constraints
+  auto repaired = [&](size_t i, int value) {
+    if (value == -2)
+      return !(repairOptions.leadingExtension && i == 0);
+    if (value < 0)
+      return true;
+    if (repairOptions.noteRange &&
+        (value < NOTES.front() || value > NOTES.back()))
+      return false;
+    return !(repairOptions.snapToScale && mode != 1 && !in_scale(value));
+  };
+  // Pitch used when a pause or an extension is turned back into a note
+  auto sounding_pitch = [&](size_t i) {
+    if (mode == 1)
+      return NOTES[0];
+    for (size_t j = i; j-- > 0;) {
+      if (melody[j] >= 0)
+        return melody[j];
+    }
+    for (size_t j = i + 1; j < melody.size(); ++j) {
+      if (melody[j] >= 0)
+        return melody[j];
+    }
+    return NOTES[NOTES.size() / 2];
+  };
+
+  int similarity = 0;
+  for (size_t i = 1; i < melody.size(); ++i) {
+    similarity += similarity_at(i, melody[i]);
   }
+  float current_fitness = melody_fitness(similarity);
+
+  bool improved = true;
+  while (improved) {
+    improved = false;
+    for (size_t i = 0; i < melody.size(); ++i) {
+      int original = melody[i];
+      std::vector<int> candidates;
+      // Single-note shifts
+      if (mode != 1 && original >= 0) {
+        for (int shift : {-1, 1, -2, 2, -12, 12}) {
+          if (original + shift >= NOTES.front() &&
+              original + shift <= NOTES.back())
+            candidates.push_back(original + shift);
+        }
+      }
+      if (mode != 2) {
+        // Extension toggle, never on the first note
+        if (i > 0 && original >= 0)
+          candidates.push_back(-2);
+        else if (i > 0 && original == -2)
+          candidates.push_back(sounding_pitch(i));
+        // Pause toggle
+        if (pauseAmount > 0.0 && original >= 0)
+          candidates.push_back(-1);
+        else if (pauseAmount > 0.0 && original == -1)
+          candidates.push_back(sounding_pitch(i));
+      }
 
-  return best_melodies;
+      for (int candidate : candidates) {
+        if (!repaired(i, candidate))
+          continue;
+        if (std::chrono::steady_clock::now() >= deadline)
+          return current_fitness;
+        change_note(melody, i, candidate, sums);
+        int candidate_similarity = similarity - similarity_at(i, original) +
+                                   similarity_at(i, candidate);
+        float candidate_fitness = melody_fitness(candidate_similarity);
+        if (candidate_fitness > current_fitness) {
+          current_fitness = candidate_fitness;
+          similarity = candidate_similarity;
+          improved = true;
+          break;
+        }
+        change_note(melody, i, original, sums);
+      }
+    }
+  }
+  return current_fitness;
 }
 
-void GeneticMelodyGenerator::test(int measures, const std::string file_name) {
-  std::ofstream file;
-  file.open("./fitness/" + file_name);
+bool GeneticMelodyGenerator::has_cached_population() const {
+  return !cachedPopulation.empty();
+}
 
-  if (!file.is_open()) {
-    std::cout << "Can't open file '" << file_name << "'" << std::endl;
+const std::vector<std::vector<int>> &
+GeneticMelodyGenerator::cached_population() const {
+  return cachedPopulation;
+}
+
+void GeneticMelodyGenerator::seed_population(
+    const std::vector<std::vector<int>> &population, float fresh_fraction,
+    float generation_fraction) {
+  seedPopulation = population;
+  seedFreshFraction = std::min(std::max(fresh_fraction, 0.0f), 1.0f);
+  seedGenerationFraction = std::min(std::max(generation_fraction, 0.0f), 1.0f);
+}
+
+std::vector<std::vector<int>>
+GeneticMelodyGenerator::rerank(int count) const {
+  int similarity_weight = 10;
+  std::vector<float> scores(cachedPopulation.size());
+  for (size_t i = 0; i < cachedPopulation.size(); ++i) {
+    scores[i] = score_features(cachedFeatures[i]) -
+                cachedSimilarity[i] * similarity_weight;
   }
-  file << "generation avg_fitness min_fitness max_fitness" << std::endl;
+  return top_melodies(cachedPopulation, scores, count);
+}
 
+std::vector<std::vector<int>>
+GeneticMelodyGenerator::run(float measures,
+                            const std::vector<int> &template_individual) {
+  TRACE_SCOPE("run");
+  runStarted = std::chrono::steady_clock::now();
+  runEvaluations = 0;
   int note_amount = static_cast<int>(meter.first / noteDuration * 4.0 /
                                      meter.second * measures);
-  std::vector<std::vector<int>> population = generate_population(note_amount);
-  std::vector<std::vector<int>> new_population;
-  float CROSSOVER_RATE = 0.9;
-  new_population.reserve(populationSize);
+  std::vector<std::vector<int>> population;
+  if (mode == 0) {
+    population = generate_population(note_amount);
+  } else if (mode == 1) {
+    population = generate_population_fixed(note_amount);
+  } else if (mode == 2) {
+    population = generate_population_from_template(template_individual);
+  }
 
-  std::vector<int> fitness_vector;
+  // Warm start: the seeded melodies replace the random ones, apart from the
+  // fresh fraction, and the evolution only needs a part of the generations
+  int generations = numGenerations;
+  if (!seedPopulation.empty() && !population.empty()) {
+    int seeded = static_cast<int>(population.size() * (1 - seedFreshFraction));
+    int count = 0;
+    for (const auto &individual : seedPopulation) {
+      if (count >= seeded)
+        break;
+      if (individual.size() == population[count].size())
+        population[count++] = individual;
+    }
+    if (count > 0)
+      generations = std::max(
+          1, static_cast<int>(numGenerations * seedGenerationFraction));
+  }
+  seedPopulation.clear();
 
-  for (int generation = 0; generation < numGenerations; ++generation) {
-    std::cout << "Generation " << generation + 1 << "/" << numGenerations;
-    file << generation + 1 << " ";
-    new_population.clear();
+  // The buffers are members, so their capacity carries over to the next run
+  std::vector<std::vector<int>> &new_population = offspringBuffer;
+  new_population.clear();
+  new_population.reserve(populationSize);
 
-    while (new_population.size() < populationSize) {
-      std::vector<int> parent1 = tournament_selection(population);
-      std::vector<int> parent2 = tournament_selection(population);
+  std::vector<FeatureVector> &features = featureBuffer;
+  std::vector<float> &similarity = similarityBuffer;
+  // Operators and parent fitness of every offspring, for crediting operators
+  std::vector<unsigned> &offspring_operators = offspringOperators;
+  std::vector<float> &parent_scores = parentScores;
+  offspring_operators.clear();
+  parent_scores.clear();
+  std::fill(operatorApplications.begin(), operatorApplications.end(), 0);
+  std::fill(operatorImprovements.begin(), operatorImprovements.end(), 0);
+
+  for (int generation = 0; generation < generations; ++generation) {
+    TRACE_SCOPE("generation");
+    new_population.clear();
+    // Every individual is scored once per generation
+    std::vector<float> scores =
+        evaluate_population(population, features, similarity);
+    credit_operators(offspring_operators, parent_scores, scores);
+    offspring_operators.clear();
+    parent_scores.clear();
+
+    report_generation(generation, generations, population, scores,
+                      similarity);
+    if (cancellationCheck && cancellationCheck())
+      return {};
+
+    while (new_population.size() < static_cast<size_t>(populationSize)) {
+      int parent1_index = tournament_selection(scores);
+      int parent2_index = tournament_selection(scores);
+      const std::vector<int> &parent1 = population[parent1_index];
+      const std::vector<int> &parent2 = population[parent2_index];
       std::vector<int> child1, child2;
+      unsigned crossed = 0;
 
-      if (prob_dist(rng) < crossoverRate && !parent1.empty() &&
+      if (prob_dist(rng) < operatorRates[CROSSOVER] && !parent1.empty() &&
           !parent2.empty()) {
         std::tie(child1, child2) = crossover(parent1, parent2);
+        crossed = 1u << CROSSOVER;
       } else {
         child1 = parent1;
         child2 = parent2;
       }
 
-      mutate(child1);
-      mutate(child2);
+      offspring_operators.push_back(crossed | mutate(child1));
+      offspring_operators.push_back(crossed | mutate(child2));
+      repair(child1);
+      repair(child2);
+      parent_scores.push_back(scores[parent1_index]);
+      parent_scores.push_back(scores[parent2_index]);
       new_population.push_back(std::move(child1));
       new_population.push_back(std::move(child2));
     }
 
-    population = std::move(new_population);
-    float population_fitness = average_fitness(population);
-    std::pair<float, float> min_and_max = min_max_fitness(population);
-    fitness_vector.push_back(population_fitness);
-    std::cout << ": Fitness = " << population_fitness << '\n';
-    file << population_fitness << " " << min_and_max.first << " "
-         << min_and_max.second << std::endl;
+    population.swap(new_population);
   }
 
-  file.close();
-  return;
+  std::vector<float> scores =
+      evaluate_population(population, features, similarity);
+  credit_operators(offspring_operators, parent_scores, scores);
+  report_generation(generations, generations, population, scores,
+                    similarity);
+  if (cancellationCheck && cancellationCheck())
+    return {};
+
+  // Keep the final population so it can be reranked when the sliders change
+  cachedPopulation.swap(population);
+  cachedFeatures.swap(features);
+  cachedSimilarity.swap(similarity);
+
+  // Collect the top 12 best melodies, optionally refined by local search
+  if (localSearchBudgetMs > 0.0f)
+    return polish(cachedPopulation, rank_population(scores, 12));
+  return top_melodies(cachedPopulation, scores, 12);
 }
 
-float GeneticMelodyGenerator::average_fitness(
-    const std::vector<std::vector<int>> &population) {
-  float fitness_sum = 0.0;
-  for (int i = 0; i < population.size(); ++i) {
-    float current_fitness = fitness(population[i], population);
-    fitness_sum += current_fitness;
-  }
-  return fitness_sum / population.size();
+bool GeneticMelodyGenerator::test(int measures, const std::string file_name) {
+  std::ofstream file(file_name);
+  if (!file.is_open())
+    return false;
+  std::shared_ptr<TelemetrySink> previous = telemetry;
+  telemetry = std::make_shared<CsvTelemetrySink>(file);
+  run(measures);
+  telemetry = previous;
+  return static_cast<bool>(file);
 }
-
-std::pair<float, float> GeneticMelodyGenerator::min_max_fitness(
-    const std::vector<std::vector<int>> &population) {
-  float min_fitness = 100000.0;
-  float max_fitness = 0.0;
-  for (int i = 0; i < population.size(); ++i) {
-    float current_fitness = fitness(population[i], population);
-    if (min_fitness > current_fitness) {
-      min_fitness = current_fitness;
-    }
-    if (max_fitness < current_fitness) {
-      max_fitness = current_fitness;
-    }
-  }
-  return {min_fitness, max_fitness};
-}
\ No newline at end of file
@@ -2,13 +2,108 @@
 #define GENETIC_MELODY_GENERATOR_HPP
 
 #include "mingus.hpp"
+#include "scale_table.hpp"
+#include "telemetry.hpp"
+#include "worker_pool.hpp"
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
 #include <map>
+#include <memory>
 #include <random>
 #include <string>
 #include <vector>
 
 class GeneticMelodyGenerator {
 public:
+  // Features scored by the fitness function, in the order in which they are
+  // accumulated (alphabetical, like the coefficient maps)
+  enum Feature {
+    AVERAGE_INTERVAL,
+    AVERAGE_PITCH,
+    DEVIATION_RHYTHMIC_VALUE,
+    DISSONANCE,
+    DIVERSITY,
+    DIVERSITY_INTERVAL,
+    LARGE_INTERVALS,
+    MELODIC_CONTOUR,
+    ODD_INDEX_NOTES,
+    PAUSE_PROPORTION,
+    PITCH_RANGE,
+    PITCH_VARIATION,
+    RHYTHMIC_AVERAGE_VALUE,
+    RHYTHMIC_DIVERSITY,
+    ROOT_CONFORMANCE,
+    SCALE_CONFORMANCE,
+    SCALE_PLAYING,
+    SHORT_CONSECUTIVE_NOTES,
+    FEATURE_COUNT
+  };
+  static const std::array<std::string, FEATURE_COUNT> FEATURE_NAMES;
+
+  // Variation operators, credited separately by the adaptive operator control
+  enum Operator {
+    EXTENSION_MUTATION,
+    PAUSE_MUTATION,
+    EXTENSION_RUN_MUTATION,
+    NOTE_REPLACEMENT_MUTATION,
+    INTERVAL_MUTATION,
+    TRANSPOSE_MUTATION,
+    SORT_MUTATION,
+    CROSSOVER,
+    OPERATOR_COUNT
+  };
+  static const std::array<std::string, OPERATOR_COUNT> OPERATOR_NAMES;
+
+  struct OperatorStats {
+    std::string name;
+    long applications; // offspring the operator took part in
+    long improvements; // ... which were fitter than their parent
+    float rate;        // current application probability
+  };
+
+  // State of run(), reported after every generation
+  struct Progress {
+    int generation; // 0 for the initial population
+    int generations;
+    float bestFitness;
+    float averageFitness;
+  };
+  using ProgressCallback = std::function<void(const Progress &)>;
+  using CancellationCheck = std::function<bool()>;
+
+  // Hard constraints enforced on every offspring after crossover and mutation
+  struct RepairOptions {
+    bool snapToScale = false;      // out-of-scale notes to the nearest in scale
+    bool leadingExtension = false; // no extension at index 0
+    bool noteRange = false;        // notes within NOTES.front()..NOTES.back()
+  };
+
+  // Raw feature values of one melody. They don't depend on the sliders, so
+  // they can be rescored whenever the coefficients change.
+  using FeatureVector = std::array<float, FEATURE_COUNT>;
+
+  // Everything the generator is built from. A long-lived generator is
+  // reconfigured with new parameters instead of being constructed again.
+  struct Parameters {
+    int mode = 0;
+    std::string scale = "C Major";
+    std::pair<int, int> noteRange = {60, 72};
+    float diversity = 0.5f;
+    float dynamics = 0.5f;
+    float arousal = 0.5f;
+    float pauseAmount = 0.5f;
+    float valence = 0.5f;
+    float jazziness = 0.5f;
+    float weirdness = 0.5f;
+    std::pair<int, int> meter = {4, 4};
+    float noteDuration = 0.5f;
+    int populationSize = 128;
+    int numGenerations = 100;
+  };
+
+  explicit GeneticMelodyGenerator(const Parameters &params);
   GeneticMelodyGenerator(int mode, const std::string &scale,
                          const std::pair<int, int> &noteRange, float diversity,
                          float dynamics, float arousal, float pauseAmount,
@@ -17,10 +112,28 @@ public:
                          float noteDuration = 0.5, int populationSize = 128,
                          int numGenerations = 100);
 
+  // Applies new parameters, recomputing only what changed: the scale tables,
+  // the note range and the coefficients. The random generator, the buffers
+  // and the cached population stay, unless the cached features no longer
+  // match the parameters (scale, note range, mode or rhythm changed).
+  void configure(const Parameters &params);
+  const Parameters &parameters() const;
+  // Forgets the last run: cached population, seed and operator rates. The
+  // buffers keep their capacity for the next run.
+  void reset();
+  // Reseeds the random generator (seeded from std::random_device by default),
+  // for reproducible runs
+  void set_seed(uint32_t seed);
+
   void set_coefficients(const std::map<std::string, float> &mu_values = {},
                         const std::map<std::string, float> &sigma_values = {},
                         const std::map<std::string, int> &weights = {});
 
+  // Changes the slider values and recomputes the default coefficients
+  void set_parameters(float diversity, float dynamics, float arousal,
+                      float pauseAmount, float valence, float jazziness,
+                      float weirdness);
+
   // Method for crossing two individuals (parents)
   std::pair<std::vector<int>, std::vector<int>>
   crossover(const std::vector<int> &parent1, const std::vector<int> &parent2);
@@ -29,22 +142,83 @@ public:
   std::vector<int>
   tournament_selection(const std::vector<std::vector<int>> &population,
                        int tournament_size = 4);
+  // Tournament selection on fitness values precomputed for the population,
+  // returns the index of the winner
+  int tournament_selection(const std::vector<float> &scores,
+                           int tournament_size = 4);
 
   // Declaration of a fitness function, which will be needed for
   // tournament_selection
   float fitness(const std::vector<int> &individual,
                 const std::vector<std::vector<int>> &population);
-  float average_fitness(const std::vector<std::vector<int>> &population);
-  std::pair<float, float>
-  min_max_fitness(const std::vector<std::vector<int>> &population);
-  void mutate(std::vector<int> &melody);
+  FeatureVector extract_features(const std::vector<int> &melody) const;
+  float score_features(const FeatureVector &features) const;
+  // Returns the mask of the operators (1 << Operator) applied to the melody
+  unsigned mutate(std::vector<int> &melody);
   std::vector<std::vector<int>>
   run(float measures = 1, const std::vector<int> &template_individual = {});
-  void test(int measures = 1, const std::string file_name = "fitness.txt");
+
+  // Rescores the population cached by the last run() with the current
+  // coefficients, without extracting the features again
+  bool has_cached_population() const;
+  const std::vector<std::vector<int>> &cached_population() const;
+  std::vector<std::vector<int>> rerank(int count = 12) const;
+
+  // Seeds the next run() with melodies from a previous run (best first).
+  // fresh_fraction of the population is still generated randomly and the run
+  // lasts generation_fraction of numGenerations.
+  void seed_population(const std::vector<std::vector<int>> &population,
+                       float fresh_fraction = 0.25f,
+                       float generation_fraction = 0.25f);
+
+  // Polishes the returned melodies with a hill-climber (single-note shifts,
+  // extension and pause toggles) running for time_budget_ms per melody. It
+  // skips the changes repair() would undo. 0 turns the local search off.
+  void set_local_search(float time_budget_ms);
+
+  // Repair stage run on every child, O(melody length)
+  void set_repair(const RepairOptions &options);
+  void repair(std::vector<int> &melody) const;
+
+  // Adapts the operator rates during run() by probability matching: every
+  // operator is credited with the fitness gain of the offspring it produced.
+  // Statistics are collected either way.
+  void set_adaptive_operators(bool enabled);
+
+  // Called by run() between generations, on the thread running it. When the
+  // cancellation check returns true, run() stops and returns no melodies; the
+  // population of the previous run stays cached.
+  void set_progress_callback(ProgressCallback callback);
+  void set_cancellation_check(CancellationCheck check);
+  // Statistics of every generation of run(), see telemetry.hpp. Without a
+  // sink (the default) they aren't computed.
+  void set_telemetry(std::shared_ptr<TelemetrySink> sink);
+  std::vector<OperatorStats> operator_stats() const;
+  // Runs the generator and writes the statistics of every generation to
+  // file_name as CSV
+  bool test(int measures = 1, const std::string file_name = "fitness.csv");
 
 private:
+  // benchmark.cpp times the private features one by one
+  friend class GeneticBenchmark;
+  // local_search_test.cpp checks the incremental features against them
+  friend class LocalSearchTest;
+
+  Parameters params;
+  bool configured = false;
+  // Scale the tables below were built for
+  ScaleTable::ScaleId scaleId;
   std::vector<int> NOTES;
-  std::vector<int> scale_notes;
+  // Bit n is set for the pitch classes n of the scale
+  uint16_t scaleMask;
+  int rootPitchClass;
+  // Pauses, extensions and other negative values are never in the scale
+  bool in_scale(int note) const {
+    return note >= 0 && (scaleMask >> (note % 12)) & 1;
+  }
+  bool is_root(int note) const {
+    return note >= 0 && note % 12 == rootPitchClass;
+  }
   std::pair<int, int> meter;
   int mode;
   float noteDuration;
@@ -62,33 +236,204 @@ private:
   float weirdness;
   float pauseAmount;
 
-  std::pair<float, float> fitness_intervals(const std::vector<int> &melody);
-  float fitness_directional_changes(const std::vector<int> &melody);
-  float fitness_melodic_contour(const std::vector<int> &melody);
-  float fitness_note_range(const std::vector<int> &melody);
-  float fitness_average_pitch(const std::vector<int> &melody);
-  float fitness_pause_proportion(const std::vector<int> &melody);
   std::pair<float, float>
-  fitness_scale_and_chord(const std::vector<int> &melody);
-  float fitness_pitch_variation(const std::vector<int> &melody);
-  float fitness_odd_index_notes(const std::vector<int> &melody);
-  float fitness_note_diversity(const std::vector<int> &melody);
-  float fitness_diversity_intervals(const std::vector<int> &melody);
-  float fitness_rhythm(const std::vector<int> &melody);
+  fitness_intervals(const std::vector<int> &melody) const;
+  float fitness_directional_changes(const std::vector<int> &melody) const;
+  float fitness_melodic_contour(const std::vector<int> &melody) const;
+  float fitness_note_range(const std::vector<int> &melody) const;
+  float fitness_average_pitch(const std::vector<int> &melody) const;
+  float fitness_pause_proportion(const std::vector<int> &melody) const;
+  std::pair<float, float>
+  fitness_scale_and_chord(const std::vector<int> &melody) const;
+  float fitness_pitch_variation(const std::vector<int> &melody) const;
+  float fitness_odd_index_notes(const std::vector<int> &melody) const;
+  float fitness_note_diversity(const std::vector<int> &melody) const;
+  float fitness_diversity_intervals(const std::vector<int> &melody) const;
+  float fitness_rhythm(const std::vector<int> &melody) const;
+  std::pair<float, float>
+  fitness_log_rhythmic_value(const std::vector<int> &melody) const;
+  float proportion_of_long_notes(const std::vector<int> &melody) const;
+  float fitness_average_intervals(const std::vector<int> &melody) const;
+  float fitness_small_intervals(const std::vector<int> &melody) const;
+  float fitness_repeated_short_notes(const std::vector<int> &melody) const;
+  float calculate_similarity_penalty(
+      const std::vector<int> &melody,
+      const std::vector<std::vector<int>> &population) const;
+
+  // Rhythm of a melody as bitboards, one per measure (bit j is step j of the
+  // measure). Only built when a measure fits into 64 steps.
+  struct MeasureBoard {
+    uint64_t notes;      // steps with a note onset
+    uint64_t extensions; // steps with -2
+    uint64_t pauses;     // steps with -1
+    uint64_t zeroPitch;  // onsets of MIDI note 0 (not counted as odd notes)
+  };
+  static const int MAX_BOARD_MEASURES = 16;
+  struct RhythmBoards {
+    int length;          // steps of the melody
+    int stepsPerMeasure; // the last measure can be partial
+    int measures;
+    int noteCount;
+    int pauseCount;
+    bool constantPitch; // every note has the same pitch, as in mode 1
+    int pitch;
+    std::array<MeasureBoard, MAX_BOARD_MEASURES> boards;
+  };
+  bool build_rhythm_boards(const std::vector<int> &melody,
+                           RhythmBoards &rhythm) const;
+  // Bitboard versions of the rhythm features, equal to the scalar ones
+  float rhythm_diversity_bits(const RhythmBoards &rhythm) const;
+  float odd_index_notes_bits(const RhythmBoards &rhythm) const;
+  float pause_proportion_bits(const RhythmBoards &rhythm) const;
   std::pair<float, float>
-  fitness_log_rhythmic_value(const std::vector<int> &melody);
-  float proportion_of_long_notes(const std::vector<int> &melody);
-  float fitness_average_intervals(const std::vector<int> &melody);
-  float fitness_small_intervals(const std::vector<int> &melody);
-  float fitness_repeated_short_notes(const std::vector<int> &melody);
-  float
-  calculate_similarity_penalty(const std::vector<int> &melody,
-                               const std::vector<std::vector<int>> &population);
+  log_rhythmic_value_bits(const RhythmBoards &rhythm) const;
+  float proportion_of_long_notes_bits(const RhythmBoards &rhythm) const;
+  // Pitch features of a melody with a single pitch, in closed form
+  void constant_pitch_features(const std::vector<int> &melody,
+                               const RhythmBoards &rhythm,
+                               FeatureVector &features) const;
+
+  // Per-measure terms of the scalar features, averaged over the measures
+  float measure_note_diversity(const std::vector<int> &melody, int start,
+                               int beat_length) const;
+  float measure_interval_diversity(const std::vector<int> &melody, int start,
+                                   int beat_length) const;
+  float measure_rhythm_diversity(const std::vector<int> &melody, int start,
+                                 int beat_length) const;
+  float measure_odd_index_notes(const std::vector<int> &melody, int start,
+                                int beat_length) const;
+
+  // The features of one melody as the counts and sums they are computed
+  // from, so that a single-note change is rescored by recounting a window
+  // around it and its measure. features_from_sums() equals
+  // extract_features() of the melody.
+  struct MeasureTerms {
+    float noteDiversity;
+    float intervalDiversity;
+    float rhythmDiversity;
+    float oddIndexNotes;
+  };
+  struct FeatureSums {
+    int length;
+    int beatLength;
+    // Notes (not pauses or extensions) and the intervals between them
+    int notes;
+    int64_t pitchSum;
+    int64_t pitchSqSum;
+    std::array<int, 128> pitchCounts; // MIDI notes, for the range
+    int intervals;
+    int dissonance;
+    int largeIntervals;
+    int risingIntervals;
+    int movingIntervals; // not unisons
+    int steps;           // intervals up to an octave
+    int stepSum;
+    int shortRepeats; // notes at most 2 above the note right before them
+    // Notes and pauses
+    int sounding;
+    int inScale;
+    int roots;
+    int smallIntervalPairs;
+    // Rhythm
+    int extensions;
+    int extensionRuns;
+    int pausedSteps; // pauses and the extensions holding them
+    std::vector<MeasureTerms> measures;
+  };
+  void init_feature_sums(const std::vector<int> &melody,
+                         FeatureSums &sums) const;
+  // Sets melody[i] to value and updates the sums
+  void change_note(std::vector<int> &melody, size_t i, int value,
+                   FeatureSums &sums) const;
+  FeatureVector features_from_sums(const FeatureSums &sums) const;
+  // Adds sign times the terms that lie within melody[first..last]
+  void add_window_terms(const std::vector<int> &melody, size_t first,
+                        size_t last, int sign, FeatureSums &sums) const;
+  MeasureTerms measure_terms(const std::vector<int> &melody, int start,
+                             int beat_length) const;
 
   // Coefficients for the genetic algorithm
   std::map<std::string, float> muValues;
   std::map<std::string, float> sigmaValues;
   std::map<std::string, int> weights;
+  // The same coefficients indexed by Feature, for scoring feature vectors
+  std::array<bool, FEATURE_COUNT> featureEnabled;
+  std::array<float, FEATURE_COUNT> featureMu;
+  std::array<float, FEATURE_COUNT> featureSigma;
+  std::array<int, FEATURE_COUNT> featureWeight;
+
+  // Final population of the last run with its raw features and similarity
+  // penalties
+  std::vector<std::vector<int>> cachedPopulation;
+  std::vector<FeatureVector> cachedFeatures;
+  std::vector<float> cachedSimilarity;
+  void drop_cached_population();
+
+  // Buffers of run(), reused by the following runs
+  std::vector<std::vector<int>> offspringBuffer;
+  std::vector<FeatureVector> featureBuffer;
+  std::vector<float> similarityBuffer;
+  std::vector<unsigned> offspringOperators;
+  std::vector<float> parentScores;
+
+  // Warm start of the next run
+  std::vector<std::vector<int>> seedPopulation;
+  float seedFreshFraction = 0.25f;
+  float seedGenerationFraction = 0.25f;
+
+  // Repair of the offspring. The offsets move a pitch class to the nearest
+  // scale note at or below / at or above it.
+  RepairOptions repairOptions;
+  std::array<int, 12> scaleOffsetBelow;
+  std::array<int, 12> scaleOffsetAbove;
+
+  // Adaptive operator control
+  bool adaptiveOperators = false;
+  std::array<float, OPERATOR_COUNT> operatorRates;
+  std::array<float, OPERATOR_COUNT> operatorQuality;
+  std::array<long, OPERATOR_COUNT> operatorApplications;
+  std::array<long, OPERATOR_COUNT> operatorImprovements;
+  void reset_operators();
+  void credit_operators(const std::vector<unsigned> &offspring_operators,
+                        const std::vector<float> &parent_scores,
+                        const std::vector<float> &scores);
+
+  ProgressCallback progressCallback;
+  CancellationCheck cancellationCheck;
+  // Feeds the progress callback and the telemetry sink after every
+  // evaluation
+  std::shared_ptr<TelemetrySink> telemetry;
+  std::chrono::steady_clock::time_point runStarted;
+  int64_t runEvaluations = 0;
+  std::vector<uint64_t> melodyHashes;
+  void report_generation(int generation, int generations,
+                         const std::vector<std::vector<int>> &population,
+                         const std::vector<float> &scores,
+                         const std::vector<float> &similarity);
+
+  // Memetic local search on the best melodies
+  static const int SIMILARITY_VALUES = 130; // pause, extension and MIDI notes
+  float localSearchBudgetMs = 0.0f;
+  // Every polished melody climbs on its own worker. Created by the first
+  // polish and kept for the following runs.
+  mutable std::unique_ptr<WorkerPool> polishWorkers;
+  std::vector<std::vector<int>>
+  polish(const std::vector<std::vector<int>> &population,
+         const std::vector<int> &indices) const;
+  float hill_climb(std::vector<int> &melody, int self_index,
+                   const std::vector<std::vector<int>> &population,
+                   const std::vector<int> &similarity_counts,
+                   std::chrono::steady_clock::time_point deadline) const;
+
+  std::vector<float>
+  evaluate_population(const std::vector<std::vector<int>> &population,
+                      std::vector<FeatureVector> &features,
+                      std::vector<float> &similarity);
+  std::vector<int> rank_population(const std::vector<float> &scores,
+                                   int count) const;
+  std::vector<std::vector<int>>
+  top_melodies(const std::vector<std::vector<int>> &population,
+               const std::vector<float> &scores, int count) const;
 
   std::mt19937 rng;
   std::uniform_real_distribution<float> prob_dist;
@@ -0,0 +1,200 @@
+// Built by CMakeLists.txt (target genetic_cli)
+//
+// ./genetic_cli [--mode 0] [--scale "C Major"] [--range 60-72] [--meter 4/4]
+//               [--duration 0.5] [--population 128] [--generations 100]
+//               [--measures 1] [--seed N] [--diversity 0.5] [--dynamics 0.5]
+//               [--arousal 0.5] [--pause 0.5] [--valence 0.5]
+//               [--jazziness 0.5] [--weirdness 0.5] [--template "60 -2 -1"]
+//               [--local-search 20] [--adaptive 1] [--repair 1]
+//               [--telemetry file.csv] [--trace file.json]
+//
+// Generates melodies like the plugin's Generate button and prints them one
+// per line (pitch, -1 pause, -2 extension), best first. Mode 2 evolves the
+// --template melody, which it needs. The time the run took goes to stderr.
+// The run options default to the plugin's: local search for the given
+// milliseconds per melody (0 turns it off; it stops on time, so only runs
+// without it are reproducible with --seed), adaptive operator rates, and the
+// repair stage (scale snapping up to a jazziness of 0.1). --telemetry writes
+// the statistics of every generation (see telemetry.hpp) as CSV. --trace
+// writes the spans of the run as Chrome trace JSON, in builds with
+// GENETIC_TRACE (see trace.hpp).
+
+#include "genetic.hpp"
+#include "trace.hpp"
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct Options {
+  GeneticMelodyGenerator::Parameters params;
+  float measures = 1.0f;
+  bool seeded = false;
+  uint32_t seed = 0;
+  std::vector<int> melodyTemplate;
+  std::string telemetry;
+  std::string trace;
+  float localSearchMs = 20.0f;
+  bool adaptiveOperators = true;
+  bool repair = true;
+};
+
+const char *USAGE =
+    "usage: genetic_cli [--mode 0] [--scale \"C Major\"] [--range 60-72]\n"
+    "                   [--meter 4/4] [--duration 0.5] [--population 128]\n"
+    "                   [--generations 100] [--measures 1] [--seed N]\n"
+    "                   [--diversity 0.5] [--dynamics 0.5] [--arousal 0.5]\n"
+    "                   [--pause 0.5] [--valence 0.5] [--jazziness 0.5]\n"
+    "                   [--weirdness 0.5] [--template \"60 -2 -1\"]\n"
+    "                   [--local-search 20] [--adaptive 1] [--repair 1]\n"
+    "                   [--telemetry file.csv] [--trace file.json]\n";
+
+bool parseOptions(int argc, char **argv, Options &options) {
+  GeneticMelodyGenerator::Parameters &params = options.params;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string name = argv[i];
+    std::string value = argv[i + 1];
+    if (name == "--mode")
+      params.mode = std::stoi(value);
+    else if (name == "--scale")
+      params.scale = value;
+    else if (name == "--range") {
+      if (std::sscanf(value.c_str(), "%d-%d", &params.noteRange.first,
+                      &params.noteRange.second) != 2)
+        return false;
+    } else if (name == "--meter") {
+      if (std::sscanf(value.c_str(), "%d/%d", &params.meter.first,
+                      &params.meter.second) != 2)
+        return false;
+    } else if (name == "--duration")
+      params.noteDuration = std::stof(value);
+    else if (name == "--population")
+      params.populationSize = std::stoi(value);
+    else if (name == "--generations")
+      params.numGenerations = std::stoi(value);
+    else if (name == "--measures")
+      options.measures = std::stof(value);
+    else if (name == "--seed") {
+      options.seeded = true;
+      options.seed = static_cast<uint32_t>(std::stoul(value));
+    } else if (name == "--diversity")
+      params.diversity = std::stof(value);
+    else if (name == "--dynamics")
+      params.dynamics = std::stof(value);
+    else if (name == "--arousal")
+      params.arousal = std::stof(value);
+    else if (name == "--pause")
+      params.pauseAmount = std::stof(value);
+    else if (name == "--valence")
+      params.valence = std::stof(value);
+    else if (name == "--jazziness")
+      params.jazziness = std::stof(value);
+    else if (name == "--weirdness")
+      params.weirdness = std::stof(value);
+    else if (name == "--template") {
+      std::istringstream notes(value);
+      int note;
+      while (notes >> note)
+        options.melodyTemplate.push_back(note);
+    } else if (name == "--local-search")
+      options.localSearchMs = std::stof(value);
+    else if (name == "--adaptive")
+      options.adaptiveOperators = std::stoi(value) != 0;
+    else if (name == "--repair")
+      options.repair = std::stoi(value) != 0;
+    else if (name == "--telemetry")
+      options.telemetry = value;
+    else if (name == "--trace")
+      options.trace = value;
+    else
+      return false;
+  }
+  return (argc - 1) % 2 == 0 && params.mode >= 0 && params.mode <= 2 &&
+         (params.mode != 2 || !options.melodyTemplate.empty()) &&
+         params.noteRange.first <= params.noteRange.second &&
+         params.meter.first > 0 && params.meter.second > 0 &&
+         params.noteDuration > 0.0f && params.populationSize > 1 &&
+         params.numGenerations > 0 && options.measures > 0.0f &&
+         options.localSearchMs >= 0.0f;
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  try {
+    if (!parseOptions(argc, argv, options)) {
+      std::cerr << USAGE;
+      return 2;
+    }
+  } catch (const std::exception &) {
+    std::cerr << "invalid number\n";
+    return 2;
+  }
+
+  auto started = std::chrono::steady_clock::now();
+  std::unique_ptr<GeneticMelodyGenerator> generator;
+  try {
+    generator = std::make_unique<GeneticMelodyGenerator>(options.params);
+  } catch (const std::exception &error) {
+    // e.g. an unknown scale
+    std::cerr << error.what() << "\n" << USAGE;
+    return 2;
+  }
+  if (options.seeded)
+    generator->set_seed(options.seed);
+  // as applyRunOptions in PluginProcessor.cpp
+  generator->set_local_search(options.localSearchMs);
+  generator->set_adaptive_operators(options.adaptiveOperators);
+  if (options.repair) {
+    GeneticMelodyGenerator::RepairOptions repairOptions;
+    repairOptions.snapToScale = options.params.jazziness <= 0.1f;
+    repairOptions.leadingExtension = true;
+    repairOptions.noteRange = true;
+    generator->set_repair(repairOptions);
+  }
+  std::ofstream telemetry;
+  if (!options.telemetry.empty()) {
+    telemetry.open(options.telemetry);
+    if (!telemetry) {
+      std::cerr << "can't write " << options.telemetry << "\n";
+      return 1;
+    }
+    generator->set_telemetry(std::make_shared<CsvTelemetrySink>(telemetry));
+  }
+  std::ofstream trace;
+  if (!options.trace.empty()) {
+    if (!Trace::ENABLED) {
+      std::cerr << "--trace needs a build with GENETIC_TRACE\n";
+      return 2;
+    }
+    trace.open(options.trace);
+    if (!trace) {
+      std::cerr << "can't write " << options.trace << "\n";
+      return 1;
+    }
+    Trace::setThreadName("genetic_cli");
+    Trace::start();
+  }
+  std::vector<std::vector<int>> melodies =
+      generator->run(options.measures, options.melodyTemplate);
+  if (!options.trace.empty()) {
+    Trace::stop();
+    size_t events = Trace::write(trace);
+    std::cerr << events << " trace events (" << Trace::dropped()
+              << " dropped) in " << options.trace << "\n";
+  }
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - started;
+
+  for (const auto &melody : melodies) {
+    for (size_t i = 0; i < melody.size(); ++i)
+      std::cout << (i ? " " : "") << melody[i];
+    std::cout << '\n';
+  }
+  std::cerr << melodies.size() << " melodies in " << elapsed.count()
+            << " ms\n";
+  return melodies.empty() ? 1 : 0;
+}
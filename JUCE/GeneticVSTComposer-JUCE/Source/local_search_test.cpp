@@ -0,0 +1,118 @@
+// Built by CMakeLists.txt (target local_search_test, run by ctest)
+//
+// Checks the local search of GeneticMelodyGenerator: the features it keeps
+// up to date through single-note changes equal extract_features() of the
+// changed melody, and the polished melodies keep the repair constraints.
+
+#include "genetic.hpp"
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+class LocalSearchTest {
+public:
+  // Changes random notes of random melodies and compares the features
+  // after every change. Returns the number of mismatches.
+  static int checkFeatureSums(GeneticMelodyGenerator &generator, int length,
+                              uint32_t seed) {
+    std::mt19937 rng(seed);
+    const std::vector<int> &notes = generator.NOTES;
+    // Mostly notes, with pauses and extensions, including runs of them
+    std::uniform_int_distribution<int> kind(0, 5);
+    std::uniform_int_distribution<size_t> pitch(0, notes.size() - 1);
+    auto random_value = [&] {
+      int k = kind(rng);
+      if (k == 0)
+        return -1;
+      if (k <= 2)
+        return -2;
+      return notes[pitch(rng)];
+    };
+
+    int failures = 0;
+    for (int melodies = 0; melodies < 20; ++melodies) {
+      std::vector<int> melody(length);
+      for (int &value : melody)
+        value = random_value();
+      GeneticMelodyGenerator::FeatureSums sums;
+      generator.init_feature_sums(melody, sums);
+      std::uniform_int_distribution<size_t> position(0, melody.size() - 1);
+      for (int changes = 0; changes < 200; ++changes) {
+        generator.change_note(melody, position(rng), random_value(), sums);
+        GeneticMelodyGenerator::FeatureVector expected =
+            generator.extract_features(melody);
+        GeneticMelodyGenerator::FeatureVector actual =
+            generator.features_from_sums(sums);
+        for (int f = 0; f < GeneticMelodyGenerator::FEATURE_COUNT; ++f) {
+          bool same = expected[f] == actual[f] ||
+                      (std::isnan(expected[f]) && std::isnan(actual[f]));
+          if (!same && failures++ < 10)
+            std::printf("length %d: %s is %g, expected %g\n", length,
+                        GeneticMelodyGenerator::FEATURE_NAMES[f].c_str(),
+                        actual[f], expected[f]);
+        }
+      }
+    }
+    return failures;
+  }
+
+  // Runs with the repair and the local search on, like the plugin, and
+  // counts the notes of the returned melodies that repair() would change
+  static int checkRepairedMelodies(uint32_t seed) {
+    GeneticMelodyGenerator::Parameters params;
+    params.jazziness = 0.0f;
+    params.numGenerations = 20;
+    GeneticMelodyGenerator generator(params);
+    generator.set_seed(seed);
+    generator.set_repair({true, true, true});
+    generator.set_local_search(20.0f);
+
+    int failures = 0;
+    for (const std::vector<int> &melody : generator.run(2)) {
+      std::vector<int> repaired = melody;
+      generator.repair(repaired);
+      for (size_t i = 0; i < melody.size(); ++i) {
+        if (melody[i] != repaired[i] && failures++ < 10)
+          std::printf("seed %u: note %d at %zu breaks the repair constraints\n",
+                      seed, melody[i], i);
+      }
+    }
+    return failures;
+  }
+};
+
+int main() {
+  int failures = 0;
+  struct Case {
+    int mode;
+    std::pair<int, int> meter;
+    float noteDuration;
+    float measures;
+  };
+  // Melodies shorter than a measure, with a partial last measure, and
+  // longer than the bitboards hold
+  const Case cases[] = {{0, {4, 4}, 0.5f, 1},     {0, {4, 4}, 0.25f, 4},
+                        {0, {3, 4}, 0.25f, 2.5f}, {0, {4, 4}, 0.5f, 0.5f},
+                        {0, {4, 4}, 0.125f, 20},  {1, {4, 4}, 0.25f, 2}};
+  uint32_t seed = 1;
+  for (const Case &c : cases) {
+    GeneticMelodyGenerator::Parameters params;
+    params.mode = c.mode;
+    params.meter = c.meter;
+    params.noteDuration = c.noteDuration;
+    GeneticMelodyGenerator generator(params);
+    int length = static_cast<int>(c.meter.first / c.noteDuration * 4.0 /
+                                  c.meter.second * c.measures);
+    failures += LocalSearchTest::checkFeatureSums(generator, length, seed++);
+  }
+  for (uint32_t repairSeed = 1; repairSeed <= 5; ++repairSeed)
+    failures += LocalSearchTest::checkRepairedMelodies(repairSeed);
+
+  if (failures > 0) {
+    std::printf("%d failures\n", failures);
+    return 1;
+  }
+  std::printf("ok\n");
+  return 0;
+}
@@ -0,0 +1,103 @@
+#include "melody_player.hpp"
+
+MelodySchedule MelodySchedule::compile(const std::vector<int> &melody,
+                                       double stepLength) {
+  MelodySchedule schedule;
+  int steps = static_cast<int>(melody.size());
+  for (int i = 0; i < steps; ++i) {
+    if (melody[i] < 0)
+      continue;
+    // the note lasts until the end of its extensions
+    int end = i + 1;
+    while (end < steps && melody[end] == -2)
+      end++;
+    schedule.notes.push_back({i * stepLength, (end - i) * stepLength,
+                              melody[i]});
+    i = end - 1;
+  }
+  schedule.length = steps * stepLength;
+  return schedule;
+}
+
+void MelodyPlayer::prepare(int maxNotes) { schedule.notes.reserve(maxNotes); }
+
+void MelodyPlayer::start(const MelodySchedule &schedule, double ppq) {
+  // within the reserved capacity the copy doesn't allocate
+  this->schedule.notes.assign(schedule.notes.begin(), schedule.notes.end());
+  this->schedule.length = schedule.length;
+  nextNote = 0;
+  origin = ppq;
+  loopStart = ppq;
+  playing = true;
+}
+
+void MelodyPlayer::stop() { playing = false; }
+
+void MelodyPlayer::seek(double ppq) {
+  if (!playing || schedule.length <= 0.0)
+    return;
+  // before the origin (a jump back past the start) the melody waits for it
+  if (ppq < origin) {
+    loopStart = origin;
+    nextNote = 0;
+    return;
+  }
+  double phase = std::fmod(ppq - origin, schedule.length);
+  loopStart = ppq - phase;
+  auto next = std::lower_bound(
+      schedule.notes.begin(), schedule.notes.end(), phase,
+      [](const ScheduledNote &note, double ppq) { return note.ppq < ppq; });
+  nextNote = next - schedule.notes.begin();
+  if (nextNote == schedule.notes.size()) {
+    nextNote = 0;
+    loopStart += schedule.length;
+  }
+}
+
+void MelodyPlayer::rebase(double offset) {
+  origin += offset;
+  loopStart += offset;
+  for (int i = 0; i < pendingCount; ++i)
+    pending[i].ppq += offset;
+}
+
+PlaybackClock::Change PlaybackClock::advance(const HostPosition &host,
+                                             int numSamples,
+                                             double sampleRate) {
+  if (host.valid) {
+    if (host.bpm > 0)
+      bpm = host.bpm;
+    if (host.numerator > 0 && host.denominator > 0) {
+      numerator = host.numerator;
+      denominator = host.denominator;
+    }
+    barStart = host.barStart;
+  }
+  samplesPerQuarter = sampleRate * 60.0 / bpm;
+
+  expected = blockEnd;
+  Change change = CONTINUOUS;
+  if (host.valid && host.playing) {
+    if (!followingHost)
+      change = RETIMED;
+    else if (std::abs(host.ppq - expected) > JUMP_TOLERANCE)
+      change = JUMP;
+    blockStart = host.ppq;
+  } else {
+    // the accumulator continues where the host stopped
+    blockStart = expected;
+  }
+  followingHost = host.valid && host.playing;
+  blockEnd = blockStart + numSamples / samplesPerQuarter;
+  return change;
+}
+
+double PlaybackClock::quantize(double ppq, Quantization quantization) const {
+  if (quantization == NO_QUANTIZATION)
+    return ppq;
+  double beat = 4.0 / denominator;
+  double step = quantization == BAR ? beat * numerator : beat;
+  // a tiny tolerance, so that a trigger right on the line starts at once
+  double steps = std::ceil((ppq - barStart) / step - 1e-9);
+  return barStart + steps * step;
+}
@@ -0,0 +1,207 @@
+#ifndef MELODY_PLAYER_HPP
+#define MELODY_PLAYER_HPP
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// A note of a compiled melody. Times are in quarter notes (ppq) from the
+// start of the melody.
+struct ScheduledNote {
+  double ppq;
+  double length;
+  int pitch;
+};
+
+// A melody compiled for playback: pauses (-1) and extensions (-2) are
+// resolved once, off the audio thread, so that playing it only touches the
+// notes that fall into a block
+struct MelodySchedule {
+  std::vector<ScheduledNote> notes;
+  double length = 0.0; // of the whole melody, after which it loops
+
+  // stepLength - quarter notes per step of the melody. An extension that
+  // doesn't follow a note (e.g. at the start) is played as a pause.
+  static MelodySchedule compile(const std::vector<int> &melody,
+                                double stepLength);
+};
+
+// Small PRNG for the audio thread: no state besides one word, no syscalls
+class XorShift32 {
+public:
+  explicit XorShift32(uint32_t seed = 2463534242u) : state(seed ? seed : 1) {}
+
+  uint32_t next() {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+  }
+  // Uniform in min..max (inclusive), for small ranges like velocity spread
+  int uniform(int min, int max) {
+    uint32_t range = static_cast<uint32_t>(max - min + 1);
+    return min + static_cast<int>(next() % range);
+  }
+
+private:
+  uint32_t state;
+};
+
+// Plays a MelodySchedule in a loop. The note-offs of the sounding notes wait
+// in a fixed-size queue, so notes may end in a later block than they start.
+// Nothing here allocates after prepare().
+class MelodyPlayer {
+public:
+  static const int MAX_PENDING_NOTE_OFFS = 16;
+
+  // Reserves space for schedules of up to maxNotes notes
+  void prepare(int maxNotes);
+
+  // Starts the schedule from its beginning at the position ppq. The note-offs
+  // of the previous schedule stay pending.
+  void start(const MelodySchedule &schedule, double ppq);
+  void stop();
+  bool isPlaying() const { return playing; }
+
+  // After a jump of the host: continues from the note the melody would have
+  // reached at ppq, counting in loops from its start. Pending note-offs
+  // should be flushed before, their times belong to the old position.
+  void seek(double ppq);
+  // Moves the melody and its pending note-offs by offset quarter notes, when
+  // the clock changes its time base without a jump of the music
+  void rebase(double offset);
+
+  // Plays the block of numSamples samples starting at blockStart (ppq).
+  // noteOn(sample, pitch) sends a note and returns the pitch it sent, which is
+  // released by noteOff(sample, pitch) once the note is over.
+  template <typename NoteOn, typename NoteOff>
+  void render(double blockStart, double samplesPerPpq, int numSamples,
+              NoteOn noteOn, NoteOff noteOff) {
+    // Events go to the nearest sample, so the block takes those rounding to
+    // one of its samples
+    double blockEnd = blockStart + (numSamples - 0.5) / samplesPerPpq;
+    auto sampleAt = [&](double ppq) {
+      int sample =
+          static_cast<int>(std::lround((ppq - blockStart) * samplesPerPpq));
+      return std::min(std::max(sample, 0), numSamples - 1);
+    };
+
+    if (playing && schedule.length > 0.0 && !schedule.notes.empty()) {
+      while (true) {
+        const ScheduledNote &note = schedule.notes[nextNote];
+        double onset = loopStart + note.ppq;
+        if (onset >= blockEnd)
+          break;
+        // a note-off at the same time goes first
+        release(onset, true, sampleAt, noteOff);
+        int sent = noteOn(sampleAt(onset), note.pitch);
+        if (pendingCount == MAX_PENDING_NOTE_OFFS)
+          release(pending[0].ppq, true, sampleAt, noteOff);
+        pending[pendingCount++] = {onset + note.length, sent};
+
+        if (++nextNote == schedule.notes.size()) {
+          nextNote = 0;
+          loopStart += schedule.length;
+        }
+      }
+    }
+    release(blockEnd, false, sampleAt, noteOff);
+  }
+
+  // Sends all pending note-offs at sample
+  template <typename NoteOff> void flush(int sample, NoteOff noteOff) {
+    for (int i = 0; i < pendingCount; ++i)
+      noteOff(sample, pending[i].pitch);
+    pendingCount = 0;
+  }
+
+private:
+  struct PendingNoteOff {
+    double ppq;
+    int pitch;
+  };
+
+  MelodySchedule schedule;
+  size_t nextNote = 0;
+  double origin = 0.0;    // ppq of the start of the first loop
+  double loopStart = 0.0; // ppq of the start of the current loop
+  bool playing = false;
+  std::array<PendingNoteOff, MAX_PENDING_NOTE_OFFS> pending;
+  int pendingCount = 0;
+
+  // Times closer than this are the same, whatever the rounding of the sums
+  // that led to them
+  static constexpr double SAME_TIME = 1e-9;
+
+  // Sends the pending note-offs before ppq (or at it, if inclusive)
+  template <typename SampleAt, typename NoteOff>
+  void release(double ppq, bool inclusive, SampleAt sampleAt,
+               NoteOff noteOff) {
+    double limit = inclusive ? ppq + SAME_TIME : ppq;
+    int kept = 0;
+    for (int i = 0; i < pendingCount; ++i) {
+      if (pending[i].ppq < limit)
+        noteOff(sampleAt(pending[i].ppq), pending[i].pitch);
+      else
+        pending[kept++] = pending[i];
+    }
+    pendingCount = kept;
+  }
+};
+
+// Position of the audio blocks in quarter notes (ppq). While the host's
+// transport plays it is the host's ppq, otherwise a double-precision
+// accumulator continues from the last position. Nothing is truncated to
+// whole samples, so the position doesn't drift over long loops.
+class PlaybackClock {
+public:
+  // What the host reports at the start of a block
+  struct HostPosition {
+    bool valid = false; // the host has a playhead
+    bool playing = false;
+    double ppq = 0.0;
+    double bpm = 120.0;
+    double barStart = 0.0; // ppq of the last bar line
+    int numerator = 4;
+    int denominator = 4;
+  };
+
+  // How the position of a block relates to the end of the previous one
+  enum Change {
+    CONTINUOUS, // including small corrections by the host
+    JUMP,       // loop wrap-around or relocation of the host
+    RETIMED     // switch between the host's ppq and the accumulator
+  };
+
+  enum Quantization { NO_QUANTIZATION, BEAT, BAR };
+
+  // Deviations from the expected position up to this are corrections (e.g.
+  // by tempo ramps within a block), larger ones are jumps
+  static constexpr double JUMP_TOLERANCE = 1.0 / 64;
+
+  // Moves to the block of numSamples samples described by host
+  Change advance(const HostPosition &host, int numSamples, double sampleRate);
+
+  double position() const { return blockStart; }
+  double samplesPerPpq() const { return samplesPerQuarter; }
+  // How far the block start moved against the expected position
+  double offset() const { return blockStart - expected; }
+
+  // The first beat or bar line at or after ppq
+  double quantize(double ppq, Quantization quantization) const;
+
+private:
+  double blockStart = 0.0;
+  double expected = 0.0; // start of the block after a continuous one
+  double blockEnd = 0.0;
+  double samplesPerQuarter = 24000.0;
+  bool followingHost = false;
+  double bpm = 120.0;
+  double barStart = 0.0;
+  int numerator = 4;
+  int denominator = 4;
+};
+
+#endif // MELODY_PLAYER_HPP
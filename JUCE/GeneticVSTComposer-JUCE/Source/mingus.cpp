@@ -1,5 +1,7 @@
 #include "mingus.hpp"
+#include <algorithm>
 #include <cctype>
+#include <cstdlib>
 #include <iostream>
 
 // UTILITY FUNCTIONS
@@ -50,45 +52,67 @@ std::string vectorToString(const std::vector<int> &data) {
   return ss;
 }
 
-// MINGUS UTILITY FUNCTIONS FOR NOTES
-const std::map<std::string, int> noteDict{
-    {"C", 0}, {"D", 2}, {"E", 4}, {"F", 5}, {"G", 7}, {"A", 9}, {"B", 11}};
-
-const std::vector<std::string> fifths = {"F", "C", "G", "D", "A", "E", "B"};
-
-// Return true if note is in a recognised format. False if not.
-bool isValidNote(std::string note) {
-  auto it = noteDict.find(note.substr(0, 1));
-  if (it == noteDict.end()) {
+// PITCH CORE
+namespace Pitch {
+bool parseNote(const std::string &name, Spelled &pitch) {
+  if (name.empty())
+    return false;
+  const std::string letters = "CDEFGAB";
+  size_t letter = letters.find(name[0]);
+  if (letter == std::string::npos)
     return false;
-  }
 
-  for (size_t i = 1; i < note.length(); ++i) {
-    if (note[i] != 'b' && note[i] != '#') {
+  pitch = {static_cast<int>(letter), 0};
+  for (size_t i = 1; i < name.length(); ++i) {
+    if (name[i] == '#') {
+      pitch.accidentals++;
+    } else if (name[i] == 'b') {
+      pitch.accidentals--;
+    } else {
       return false;
     }
   }
   return true;
 }
 
+std::string noteName(const Spelled &pitch) {
+  std::string name(1, "CDEFGAB"[pitch.letter]);
+  name.append(std::abs(pitch.accidentals), pitch.accidentals > 0 ? '#' : 'b');
+  return name;
+}
+
+bool parseKey(const std::string &key, int &signature, int &tonicLetter) {
+  if (key.empty() || key.length() > 2)
+    return false;
+  bool minor = isLower(key[0]);
+  std::string note = key;
+  note[0] = std::toupper(note[0]);
+  Spelled tonic;
+  if (!parseNote(note, tonic))
+    return false;
+  signature = keySignature(tonic, minor);
+  tonicLetter = tonic.letter;
+  return signature >= -7 && signature <= 7;
+}
+} // namespace Pitch
+
+// MINGUS UTILITY FUNCTIONS FOR NOTES
+const std::vector<std::string> fifths = {"F", "C", "G", "D", "A", "E", "B"};
+
+// Return true if note is in a recognised format. False if not.
+bool isValidNote(std::string note) {
+  Pitch::Spelled pitch;
+  return Pitch::parseNote(note, pitch);
+}
+
 // Convert notes in the form of C, C#, Cb, C##, etc. to an integer in the range
 // of 0-11.
 int noteToInt(std::string note) {
-  if (!isValidNote(note)) {
+  Pitch::Spelled pitch;
+  if (!Pitch::parseNote(note, pitch)) {
     throw std::invalid_argument("Unknown note format '" + note + "'");
   }
-
-  int val = noteDict.at(note.substr(0, 1)); // note[0]
-
-  for (size_t i = 1; i < note.length(); ++i) {
-
-    if (note[i] == 'b') {
-      val--;
-    } else if (note[i] == '#') {
-      val++;
-    }
-  }
-  return val;
+  return Pitch::toInt(pitch);
 }
 
 std::string intToNote(int noteInt, const std::string &accidentals = "#") {
@@ -128,51 +152,19 @@ int Note::toInt() const {
 
 // MINGUS UTILITY FUNCTIONS FOR SCALES
 
-// Map of keys
-std::vector<std::pair<std::string, std::string>> keys = {
-    {"Cb", "ab"}, //  7 b
-    {"Gb", "eb"}, //  6 b
-    {"Db", "bb"}, //  5 b
-    {"Ab", "f"},  //  4 b
-    {"Eb", "c"},  //  3 b
-    {"Bb", "g"},  //  2 b
-    {"F", "d"},   //  1 b
-    {"C", "a"},   //  nothing
-    {"G", "e"},   //  1 #
-    {"D", "b"},   //  2 #
-    {"A", "f#"},  //  3 #
-    {"E", "c#"},  //  4 #
-    {"B", "g#"},  //  5 #
-    {"F#", "d#"}, //  6 #
-    {"C#", "a#"}  //  7 #
-};
-
-std::vector<std::string> baseScale = {"C", "D", "E", "F", "G", "A", "B"};
-
-std::map<std::string, std::vector<std::string>> _key_cache;
-
 // Function to check if a key is in a recognized format
 bool isValidKey(const std::string &key) {
-  for (auto it = keys.begin(); it != keys.end(); ++it) {
-    if (key == it->first || key == it->second) {
-      return true;
-    }
-  }
-  return false;
+  int signature, tonicLetter;
+  return Pitch::parseKey(key, signature, tonicLetter);
 }
 
 // Function to get the key signature
 int getKeySignature(const std::string &key = "C") {
-  if (!isValidKey(key)) {
+  int signature, tonicLetter;
+  if (!Pitch::parseKey(key, signature, tonicLetter)) {
     throw std::invalid_argument("unrecognized format for key '" + key + "'");
   }
-
-  for (auto it = keys.begin(); it != keys.end(); ++it) {
-    if (key == it->first || key == it->second) {
-      return std::distance(keys.begin(), it) - 7;
-    }
-  }
-  return 0; // Default to C
+  return signature;
 }
 
 // Function to get the key signature accidentals
@@ -195,45 +187,15 @@ getKeySignatureAccidentals(const std::string &key = "C") {
 
 // Function to get the notes in a natural key
 std::vector<std::string> getNotes(const std::string &key = "C") {
-  if (_key_cache.find(key) != _key_cache.end()) {
-    return _key_cache[key];
-  }
-  if (!isValidKey(key)) {
+  int signature, tonicLetter;
+  if (!Pitch::parseKey(key, signature, tonicLetter)) {
     throw std::invalid_argument("unrecognized format for key '" + key + "'");
   }
 
   std::vector<std::string> result;
-
-  std::vector<std::string> alteredNotes;
-  std::vector<std::string> accidentals = getKeySignatureAccidentals(key);
-  for (const auto &accidental : accidentals) {
-    alteredNotes.push_back(accidental.substr(0, 1));
-  }
-
-  std::string symbol;
-  int keySignature = getKeySignature(key);
-  if (keySignature < 0) {
-    symbol = "b";
-  } else if (keySignature > 0) {
-    symbol = "#";
-  }
-
-  auto rawTonicIndexIt =
-      std::find(baseScale.begin(), baseScale.end(), toUpper(key.substr(0, 1)));
-  int rawTonicIndex = std::distance(baseScale.begin(), rawTonicIndexIt);
-
-  for (int i = rawTonicIndex; i < rawTonicIndex + 7; ++i) {
-    std::string note = baseScale[i % baseScale.size()];
-    if (std::find(alteredNotes.begin(), alteredNotes.end(), note) !=
-        alteredNotes.end()) {
-      result.push_back(note + symbol);
-    } else {
-      result.push_back(note);
-    }
+  for (int i = tonicLetter; i < tonicLetter + 7; ++i) {
+    result.push_back(Pitch::noteName(Pitch::keyNote(signature, i % 7)));
   }
-
-  // Save result to cache
-  _key_cache[key] = result;
   return result;
 }
 
@@ -265,63 +227,29 @@ int measure(const std::string &note1, const std::string &note2) {
 std::string augmentOrDiminishUntilTheIntervalIsRight(std::string note1,
                                                      std::string note2,
                                                      int interval) {
-  int cur = measure(note1, note2);
-  while (cur != interval) {
-    if (cur > interval) {
-      note2 = diminish(note2);
-    } else if (cur < interval) {
-      note2 = augment(note2);
-    }
-    cur = measure(note1, note2);
-  }
-
-  // Calculating the alteration value
-  int val = 0;
-  for (size_t i = 1; i < note2.size(); ++i) {
-    if (note2[i] == '#') {
-      val += 1;
-    } else if (note2[i] == 'b') {
-      val -= 1;
-    }
-  }
-
-  // Adjusting alteration value if necessary
-  if (val > 6) {
-    val %= 12;
-    val = -12 + val;
-  } else if (val < -6) {
-    val %= -12;
-    val = 12 + val;
-  }
-
-  // Rebuilding the note
-  std::string result = note2.substr(0, 1);
-  while (val > 0) {
-    result = augment(result);
-    val -= 1;
+  Pitch::Spelled pitch1, pitch2;
+  if (!Pitch::parseNote(note2, pitch2)) {
+    throw std::invalid_argument("Unknown note format '" + note2 + "'");
   }
-  while (val < 0) {
-    result = diminish(result);
-    val += 1;
+  if (!Pitch::parseNote(note1, pitch1)) {
+    throw std::invalid_argument("Unknown note format '" + note1 + "'");
   }
-  return result;
+  return Pitch::noteName(Pitch::adjustToInterval(pitch1, pitch2, interval));
 }
 
 std::string interval(const std::string &key, const std::string &startNote,
                      int interval) {
-  if (!isValidNote(startNote)) {
+  Pitch::Spelled start;
+  if (!Pitch::parseNote(startNote, start)) {
     throw std::invalid_argument("The start note '" + startNote +
                                 "' is not a valid note");
   }
-  std::vector<std::string> notesInKey = getNotes(key);
-  size_t index = 0;
-  for (size_t i = 0; i < notesInKey.size(); ++i) {
-    if (notesInKey[i][0] == startNote[0]) {
-      index = i;
-      break;
-    }
+  int signature, tonicLetter;
+  if (!Pitch::parseKey(key, signature, tonicLetter)) {
+    throw std::invalid_argument("unrecognized format for key '" + key + "'");
   }
-  return notesInKey[(index + interval) % 7];
+  return Pitch::noteName(
+      Pitch::keyNote(signature, (start.letter + interval) % 7));
 }
 
 std::string unison(const std::string &note) { return interval(note, note, 0); }
@@ -403,6 +331,19 @@ std::string majorSeventh(const std::string &note) {
   return augmentOrDiminishUntilTheIntervalIsRight(note, sth, 11);
 }
 
+// [name, shorthand name, half notes of the major version of the interval],
+// indexed by the number of fifth steps between the letters
+struct IntervalName {
+  const char *name;
+  const char *shorthand;
+  int majorSemitones;
+};
+const IntervalName fifthSteps[7] = {
+    {"unison", "1", 0}, {"fifth", "5", 7},  {"second", "2", 2},
+    {"sixth", "6", 9},  {"third", "3", 4},  {"seventh", "7", 11},
+    {"fourth", "4", 5},
+};
+
 std::string determine(const std::string &note1, const std::string &note2,
                       bool shorthand = false) {
   // Corner case for unisons
@@ -446,65 +387,56 @@ std::string determine(const std::string &note1, const std::string &note2,
   }
 
   // Other intervals
-  size_t n1 = std::find(fifths.begin(), fifths.end(), note1.substr(0, 1)) -
-              fifths.begin();
-  size_t n2 = std::find(fifths.begin(), fifths.end(), note2.substr(0, 1)) -
-              fifths.begin();
-  int numberOfFifthSteps = static_cast<int>(n2 - n1);
-  if (n2 < n1) {
-    numberOfFifthSteps += fifths.size();
-  }
-
-  // [name, shorthand_name, half notes for major version of this interval]
-  std::vector<std::vector<std::string>> fifthSteps = {
-      {"unison", "1", "0"}, {"fifth", "5", "7"}, {"second", "2", "2"},
-      {"sixth", "6", "9"},  {"third", "3", "4"}, {"seventh", "7", "11"},
-      {"fourth", "4", "5"},
-  };
-
-  // Count half steps between note1 and note2
+  // Count half steps between note1 and note2 (this also validates both notes)
   int halfNotes = measure(note1, note2);
 
-  // Get the proper list from the number of fifth steps
-  auto current = fifthSteps[numberOfFifthSteps];
+  Pitch::Spelled pitch1, pitch2;
+  Pitch::parseNote(note1, pitch1);
+  Pitch::parseNote(note2, pitch2);
+  int numberOfFifthSteps = (Pitch::LETTER_FIFTHS[pitch2.letter] -
+                            Pitch::LETTER_FIFTHS[pitch1.letter] + 7) %
+                           7;
+
+  // Get the proper entry from the number of fifth steps
+  const IntervalName &current = fifthSteps[numberOfFifthSteps];
 
   // maj = number of major steps for this interval
-  int maj = std::stoi(current[2]);
+  int maj = current.majorSemitones;
 
   // if maj is equal to the half steps between note1 and note2 the interval is
   // major or perfect
   if (maj == halfNotes) {
     // Corner cases for perfect fifths and fourths
-    if (current[0] == "fifth") {
+    if (numberOfFifthSteps == 1) { // fifth
       if (!shorthand) {
         return "perfect fifth";
       }
-    } else if (current[0] == "fourth") {
+    } else if (numberOfFifthSteps == 6) { // fourth
       if (!shorthand) {
         return "perfect fourth";
       }
     }
     if (!shorthand) {
-      return "major " + current[0];
+      return std::string("major ") + current.name;
     }
-    return current[1];
+    return current.shorthand;
   } else if (maj + 1 <= halfNotes) {
     // if maj + 1 is equal to half_notes, the interval is augmented.
     if (!shorthand) {
-      return "augmented " + current[0];
+      return std::string("augmented ") + current.name;
     }
-    return std::string(halfNotes - maj, '#') + current[1];
+    return std::string(halfNotes - maj, '#') + current.shorthand;
   } else if (maj - 1 == halfNotes) {
     // etc.
     if (!shorthand) {
-      return "minor " + current[0];
+      return std::string("minor ") + current.name;
     }
-    return "b" + current[1];
+    return std::string("b") + current.shorthand;
   } else if (maj - 2 >= halfNotes) {
     if (!shorthand) {
-      return "diminished " + current[0];
+      return std::string("diminished ") + current.name;
     }
-    return std::string(maj - halfNotes, 'b') + current[1];
+    return std::string(maj - halfNotes, 'b') + current.shorthand;
   } else {
     throw std::invalid_argument("Cannot determine note interval between '" +
                                 note1 + "' and '" + note2 + "'");
@@ -1,12 +1,81 @@
 #ifndef MINGUS_HPP
 #define MINGUS_HPP
 
+#include <array>
 #include <iostream>
-#include <map>
 #include <stdexcept>
 #include <string>
 #include <vector>
 
+// Integer core of the note, key and interval functions. A spelled pitch is a
+// letter (0-6 for C-B) with a signed number of accidentals (sharps > 0, flats
+// < 0). Everything works on constant tables, so the functions can be called
+// from several threads at once; the string API is a wrapper around them.
+namespace Pitch {
+struct Spelled {
+  int letter;
+  int accidentals;
+};
+
+// Semitones of the natural letters above C
+constexpr std::array<int, 7> LETTER_SEMITONES = {0, 2, 4, 5, 7, 9, 11};
+// Position of the letters in the order of fifths F C G D A E B
+constexpr std::array<int, 7> LETTER_FIFTHS = {1, 3, 5, 0, 2, 4, 6};
+
+// Parses names like C, C#, Db or C## (accidentals may be mixed)
+bool parseNote(const std::string &name, Spelled &pitch);
+std::string noteName(const Spelled &pitch);
+
+// Semitones above C, not reduced to 0-11 (Cb is -1, B# is 12)
+constexpr int toInt(const Spelled &pitch) {
+  return LETTER_SEMITONES[pitch.letter] + pitch.accidentals;
+}
+
+// Sharps (> 0) or flats (< 0) of the major or minor key on the tonic
+constexpr int keySignature(const Spelled &tonic, bool minor) {
+  return LETTER_FIFTHS[tonic.letter] - (minor ? 4 : 1) + 7 * tonic.accidentals;
+}
+
+// Parses a key: upper case for major and lower case for minor keys, with at
+// most one accidental and at most seven sharps or flats
+bool parseKey(const std::string &key, int &signature, int &tonicLetter);
+
+// The letter as it is spelled in a key with the signature
+constexpr Spelled keyNote(int signature, int letter) {
+  int position = LETTER_FIFTHS[letter];
+  int accidentals = signature > 0   ? (position < signature ? 1 : 0)
+                    : signature < 0 ? (position >= 7 + signature ? -1 : 0)
+                                    : 0;
+  return {letter, accidentals};
+}
+
+// Semitones from a up to b. Negative differences are moved up an octave,
+// other values are not reduced.
+constexpr int measure(const Spelled &a, const Spelled &b) {
+  int difference = toInt(b) - toInt(a);
+  return difference < 0 ? 12 + difference : difference;
+}
+
+// Respells b with the same letter so that it lies the semitones (0-11) above
+// a. More than six accidentals are folded back by an octave.
+constexpr Spelled adjustToInterval(const Spelled &a, const Spelled &b,
+                                   int semitones) {
+  int difference = toInt(b) - toInt(a);
+  int target = difference >= 0 ? semitones : semitones - 12;
+  int accidentals = b.accidentals + target - difference;
+  if (accidentals > 6)
+    accidentals = accidentals % 12 - 12;
+  else if (accidentals < -6)
+    accidentals = accidentals % -12 + 12;
+  return {b.letter, accidentals};
+}
+
+static_assert(keySignature({6, -1}, false) == -2, "Bb major has two flats");
+static_assert(keySignature({3, 1}, true) == 3, "f# minor has three sharps");
+static_assert(adjustToInterval({0, 0}, {2, 0}, 3).accidentals == -1,
+              "a minor third above C is Eb");
+} // namespace Pitch
+
 class Note {
 private:
   std::string name;
@@ -1,143 +1,80 @@
 #include "notes_generator.hpp"
-#include "mingus.hpp"
-#include <functional>
+#include <cctype>
 #include <iostream>
-#include <map>
-#include <regex>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 
-std::string strip(const std::string &str) {
-  size_t start = 0;
-  size_t end = str.length() - 1;
-
-  while (start <= end && std::isspace(str[start])) {
-    start++;
-  }
-  while (end >= start && std::isspace(str[end])) {
-    end--;
-  }
-
-  return str.substr(start, end - start + 1);
-}
-
-std::vector<std::string> split(const std::string &s, char delim) {
-  std::vector<std::string> tokens;
-  std::string token;
-  size_t start = 0;
-  size_t end = 0;
-
-  while ((end = s.find(delim, start)) != std::string::npos) {
-    token = s.substr(start, end - start);
-    tokens.push_back(token);
-    start = end + 1;
-  }
-
-  token = s.substr(start);
-  tokens.push_back(token);
-
-  return tokens;
+static bool isSpace(char c) {
+  return std::isspace(static_cast<unsigned char>(c)) != 0;
 }
 
-std::pair<std::string, std::string> NotesGenerator::parseScaleName() {
-  std::regex pattern("([A-G]#?|Bb)(.*)");
-  std::smatch match;
-  if (std::regex_match(key, match, pattern)) {
-    std::string note = match[1];
-    std::string scaleType = strip(match[2]);
-    return std::make_pair(note, scaleType);
-  } else {
+std::pair<std::string_view, std::string_view>
+NotesGenerator::parseScaleName() const {
+  // Same language as the former regex "([A-G]#?|Bb)(.*)": a letter, an
+  // optional sharp, then anything without line breaks
+  std::string_view name(key);
+  if (name.empty() || name[0] < 'A' || name[0] > 'G' ||
+      name.find_first_of("\r\n") != std::string_view::npos) {
     throw std::invalid_argument("Wrong scale name");
   }
+  size_t noteLength = name.size() > 1 && name[1] == '#' ? 2 : 1;
+  std::string_view note = name.substr(0, noteLength);
+  std::string_view scaleType = name.substr(noteLength);
+
+  while (!scaleType.empty() && isSpace(scaleType.front()))
+    scaleType.remove_prefix(1);
+  while (!scaleType.empty() && isSpace(scaleType.back()))
+    scaleType.remove_suffix(1);
+  return std::make_pair(note, scaleType);
 }
 
-std::vector<std::string> NotesGenerator::chooseScale() {
-  std::pair<std::string, std::string> scaleNameData = parseScaleName();
-  std::string note = scaleNameData.first;
-  std::string scaleType = scaleNameData.second;
+ScaleTable::Key NotesGenerator::chooseScale() const {
+  std::pair<std::string_view, std::string_view> scaleNameData =
+      parseScaleName();
+  std::string_view note = scaleNameData.first;
+  std::string_view scaleType = scaleNameData.second;
 
-  std::map<std::string, std::function<Scales::Scale *(const std::string &)>>
-      scaleMethods = {
-          {"Harmonic Minor",
-           [](const std::string &str) {
-             return new Scales::HarmonicMinor(str);
-           }},
-          {"Natural Minor",
-           [](const std::string &str) {
-             return new Scales::NaturalMinor(str);
-           }},
-          {"Melodic Minor",
-           [](const std::string &str) {
-             return new Scales::MelodicMinor(str);
-           }},
-          {"Major",
-           [](const std::string &str) { return new Scales::Major(str); }},
-          {"Ionian",
-           [](const std::string &str) { return new Scales::Ionian(str); }},
-          {"Dorian",
-           [](const std::string &str) { return new Scales::Dorian(str); }},
-          {"Phrygian",
-           [](const std::string &str) { return new Scales::Phrygian(str); }},
-          {"Lydian",
-           [](const std::string &str) { return new Scales::Lydian(str); }},
-          {"Mixolydian",
-           [](const std::string &str) { return new Scales::Mixolydian(str); }},
-          {"Aeolian",
-           [](const std::string &str) { return new Scales::Aeolian(str); }},
-          {"Locrian",
-           [](const std::string &str) { return new Scales::Locrian(str); }},
-          {"Chromatic",
-           [](const std::string &str) { return new Scales::Chromatic(str); }},
-          {"Whole Tone",
-           [](const std::string &str) { return new Scales::WholeTone(str); }},
-          {"Octatonic",
-           [](const std::string &str) { return new Scales::Octatonic(str); }},
-      };
+  int tonic = ScaleTable::letterPitchClass(note[0]);
+  if (note.size() > 1)
+    tonic = (tonic + 1) % 12;
 
-  if (scaleMethods.find(scaleType) != scaleMethods.end()) {
-    auto scale = scaleMethods[scaleType](note)->ascending();
-    scale.pop_back();
-    return scale;
-  } else {
-    std::vector<std::string> scaleTypeSplitted = split(scaleType, ' ');
-    for (const std::string &word : scaleTypeSplitted) {
-      for (auto it = scaleMethods.begin(); it != scaleMethods.end(); ++it) {
-        const std::string &key = it->first;
-        const std::function<Scales::Scale *(const std::string &)> &value =
-            it->second;
+  ScaleTable::ScaleType exact;
+  if (ScaleTable::findScaleType(scaleType, exact))
+    return {tonic, exact};
 
-        if (key.find(word) != std::string::npos) {
-          std::vector<std::string> scale = value(note)->ascending();
-          scale.pop_back();
-          return scale;
-        }
-      }
+  // Otherwise the first scale type containing one of the words
+  size_t start = 0;
+  while (true) {
+    size_t end = scaleType.find(' ', start);
+    std::string_view word = scaleType.substr(start, end - start);
+    for (int type = 0; type < ScaleTable::SCALE_TYPE_COUNT; ++type) {
+      if (std::string_view(ScaleTable::SCALES[type].name).find(word) !=
+          std::string_view::npos)
+        return {tonic, static_cast<ScaleTable::ScaleType>(type)};
     }
-    std::cout << "Unknown scale. Choosing chromatic..." << std::endl;
-    auto scale = Scales::Chromatic(note).ascending();
-    scale.pop_back();
-    return scale;
+    if (end == std::string_view::npos)
+      break;
+    start = end + 1;
   }
+  std::cout << "Unknown scale. Choosing chromatic..." << std::endl;
+  return {tonic, ScaleTable::CHROMATIC};
 }
 
-std::vector<int> NotesGenerator::g_scale_notes = {};
 NotesGenerator::NotesGenerator(const std::string &key) : key(key) {}
 
 std::vector<int> NotesGenerator::generateNotes(int numberOfOctaves,
                                                int startOctave) {
-  std::vector<std::string> scale = chooseScale();
+  ScaleTable::PitchClasses scale = ScaleTable::pitchClasses(chooseScale());
   std::vector<int> notes;
+  notes.reserve(numberOfOctaves * scale.size);
 
+  // Pitch classes only, so every octave repeats the same values
   for (int octave = startOctave; octave < startOctave + numberOfOctaves;
        ++octave) {
-    for (const std::string &note : scale) {
-      int noteValue = Note(note, octave).toInt();
-      if (!notes.empty() && noteValue <= notes.back()) {
-        noteValue += 12;
-      }
-      notes.push_back(noteValue % 12);
-    }
+    notes.insert(notes.end(), scale.notes.begin(),
+                 scale.notes.begin() + scale.size);
   }
 
   return notes;
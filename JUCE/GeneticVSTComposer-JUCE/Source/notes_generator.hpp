@@ -1,23 +1,26 @@
 #ifndef NOTES_GENERATOR_HPP
 #define NOTES_GENERATOR_HPP
 
-#include <map>
-#include <regex>
+#include "scale_table.hpp"
 #include <string>
+#include <string_view>
 #include <vector>
 
 class NotesGenerator {
 private:
   std::string key;
 
-  std::pair<std::string, std::string> parseScaleName();
-
-  std::vector<std::string> chooseScale();
+  // Splits the key into the tonic ("C", "C#") and the scale type name,
+  // throws std::invalid_argument for keys not starting with a tonic
+  std::pair<std::string_view, std::string_view> parseScaleName() const;
 
 public:
-  static std::vector<int> g_scale_notes;
   NotesGenerator(const std::string &key = "C Major");
 
+  // Tonic and scale type named by the key. Unknown scale types fall back to
+  // the chromatic scale.
+  ScaleTable::Key chooseScale() const;
+
   std::vector<int> generateNotes(int numberOfOctaves = 1, int startOctave = 4);
 
   std::vector<int> generateChromaticNotes(const std::pair<int, int> &noteRange);
@@ -0,0 +1,285 @@
+// Built by CMakeLists.txt (target offline_render, with GENETIC_JUCE_DIR set)
+//
+// ./offline_render [--bpm 120] [--meter 4/4] [--bars 32] [--block 512|random]
+//                  [--rate 48000] [--seed 1] [--script keys.txt]
+//                  [--out render.mid]
+//
+// Renders the processor offline, without a GUI or an audio device: a
+// simulated host plays at the given tempo and meter, the script presses
+// and releases keys, and the MIDI the processor sends is written to a MIDI
+// file. Reports the cost of processBlock and how much faster than real time
+// the render ran.
+//
+// A script has one key event per line, "<beat> on|off <note>", with the beat
+// counted in quarter notes from the start; '#' starts a comment. The default
+// triggers the first melody, transposes it, switches melodies and stops.
+
+#include "PluginProcessor.h"
+#include <JuceHeader.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Host transport, moved on after every block
+class RenderPlayHead : public juce::AudioPlayHead {
+public:
+  double ppq = 0.0;
+  double bpm = 120.0;
+  int numerator = 4;
+  int denominator = 4;
+
+  double barStart() const {
+    double barLength = numerator * 4.0 / denominator;
+    return std::floor(ppq / barLength) * barLength;
+  }
+
+#if JUCE_MAJOR_VERSION >= 7
+  juce::Optional<PositionInfo> getPosition() const override {
+    PositionInfo info;
+    info.setIsPlaying(true);
+    info.setPpqPosition(ppq);
+    info.setBpm(bpm);
+    info.setPpqPositionOfLastBarStart(barStart());
+    info.setTimeSignature(TimeSignature{numerator, denominator});
+    return info;
+  }
+#else
+  bool getCurrentPosition(CurrentPositionInfo &info) override {
+    info.resetToDefault();
+    info.isPlaying = true;
+    info.ppqPosition = ppq;
+    info.bpm = bpm;
+    info.ppqPositionOfLastBarStart = barStart();
+    info.timeSigNumerator = numerator;
+    info.timeSigDenominator = denominator;
+    return true;
+  }
+#endif
+};
+
+struct KeyEvent {
+  double ppq;
+  bool pressed;
+  int note;
+};
+
+struct Options {
+  double bpm = 120.0;
+  int numerator = 4;
+  int denominator = 4;
+  int bars = 32;
+  int blockSize = 512; // 0 - random sizes from 16 to 4096
+  double sampleRate = 48000.0;
+  int seed = 1;
+  std::string script;
+  std::string out = "render.mid";
+};
+
+std::vector<KeyEvent> defaultScript() {
+  return {
+      {0.0, true, 48},   // first melody
+      {8.0, true, 62},   // transposed by two
+      {16.0, false, 62}, // and back
+      {24.0, true, 49},  // second melody
+      {56.0, false, 49}, // stop
+      {64.0, true, 50},  // third melody
+      {96.0, false, 50},
+  };
+}
+
+bool readScript(const std::string &path, std::vector<KeyEvent> &events) {
+  std::ifstream file(path);
+  if (!file)
+    return false;
+  std::string line;
+  while (std::getline(file, line)) {
+    line = line.substr(0, line.find('#'));
+    std::istringstream fields(line);
+    KeyEvent event;
+    std::string state;
+    if (!(fields >> event.ppq >> state >> event.note))
+      continue;
+    event.pressed = state == "on";
+    events.push_back(event);
+  }
+  std::stable_sort(events.begin(), events.end(),
+                   [](const KeyEvent &a, const KeyEvent &b) {
+                     return a.ppq < b.ppq;
+                   });
+  return true;
+}
+
+bool parseOptions(int argc, char **argv, Options &options) {
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string name = argv[i];
+    std::string value = argv[i + 1];
+    if (name == "--bpm")
+      options.bpm = std::stod(value);
+    else if (name == "--meter") {
+      if (std::sscanf(value.c_str(), "%d/%d", &options.numerator,
+                      &options.denominator) != 2)
+        return false;
+    } else if (name == "--bars")
+      options.bars = std::stoi(value);
+    else if (name == "--block")
+      options.blockSize = value == "random" ? 0 : std::stoi(value);
+    else if (name == "--rate")
+      options.sampleRate = std::stod(value);
+    else if (name == "--seed")
+      options.seed = std::stoi(value);
+    else if (name == "--script")
+      options.script = value;
+    else if (name == "--out")
+      options.out = value;
+    else
+      return false;
+  }
+  return (argc - 1) % 2 == 0 && options.bpm > 0.0 && options.numerator > 0 &&
+         options.denominator > 0 && options.bars > 0 &&
+         options.blockSize >= 0 && options.blockSize <= 4096 &&
+         options.sampleRate > 0.0;
+}
+
+int main(int argc, char **argv) {
+  juce::ScopedJuceInitialiser_GUI juceInitialiser;
+  Options options;
+  try {
+    if (!parseOptions(argc, argv, options)) {
+      std::printf("usage: offline_render [--bpm 120] [--meter 4/4] "
+                  "[--bars 32] [--block 512|random] [--rate 48000] "
+                  "[--seed 1] [--script keys.txt] [--out render.mid]\n");
+      return 2;
+    }
+  } catch (const std::exception &) {
+    std::printf("invalid number\n");
+    return 2;
+  }
+  std::vector<KeyEvent> script = defaultScript();
+  if (!options.script.empty()) {
+    script.clear();
+    if (!readScript(options.script, script)) {
+      std::printf("can't read %s\n", options.script.c_str());
+      return 1;
+    }
+  }
+
+  // the calibration would run next to what is measured
+  GeneticVSTComposerJUCEAudioProcessor::setPresetCalibration(false);
+  GeneticVSTComposerJUCEAudioProcessor processor;
+  RenderPlayHead playHead;
+  playHead.bpm = options.bpm;
+  playHead.numerator = options.numerator;
+  playHead.denominator = options.denominator;
+  processor.setPlayHead(&playHead);
+  processor.prepareToPlay(options.sampleRate, 4096);
+
+  // One block first, so the processor knows the meter to generate for
+  juce::AudioBuffer<float> buffer(0, 16);
+  juce::MidiBuffer midi;
+  processor.processBlock(buffer, midi);
+  processor.GenerateMelody(0, "C Major", {60, 72}, 0.5f, 0.5f, 0.5f, 0.5f,
+                           0.5f, 0.5f, 0.5f, 0.25f, 128, 100, 2.0f);
+  for (int i = 0; i < 6000 && processor.isGenerating(); ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  if (processor.isGenerating()) {
+    std::printf("the generation didn't finish\n");
+    return 1;
+  }
+  AudioStats::Snapshot statsBefore = processor.readAudioStats();
+
+  const double samplesPerPpq = options.sampleRate * 60.0 / options.bpm;
+  const double length =
+      options.bars * options.numerator * 4.0 / options.denominator;
+  const int ticksPerQuarter = 960;
+  juce::MidiMessageSequence sequence;
+  juce::Random random(options.seed);
+  std::vector<double> blockTimes; // microseconds
+  size_t nextKey = 0;
+  long samples = 0;
+  auto renderStarted = std::chrono::steady_clock::now();
+
+  while (playHead.ppq < length) {
+    int numSamples = options.blockSize > 0 ? options.blockSize
+                                           : 16 << random.nextInt(9);
+    double blockEnd = playHead.ppq + numSamples / samplesPerPpq;
+    buffer.setSize(0, numSamples, false, false, true);
+    midi.clear();
+    for (; nextKey < script.size() && script[nextKey].ppq < blockEnd;
+         ++nextKey) {
+      const KeyEvent &key = script[nextKey];
+      int sample = static_cast<int>(
+          std::max(0.0, (key.ppq - playHead.ppq) * samplesPerPpq));
+      sample = std::min(sample, numSamples - 1);
+      midi.addEvent(key.pressed ? juce::MidiMessage::noteOn(1, key.note,
+                                                            (juce::uint8)100)
+                                : juce::MidiMessage::noteOff(1, key.note),
+                    sample);
+    }
+
+    auto started = std::chrono::steady_clock::now();
+    processor.processBlock(buffer, midi);
+    std::chrono::duration<double, std::micro> elapsed =
+        std::chrono::steady_clock::now() - started;
+    blockTimes.push_back(elapsed.count());
+
+    for (const auto &metadata : midi) {
+      juce::MidiMessage message = metadata.getMessage();
+      double ppq = playHead.ppq + metadata.samplePosition / samplesPerPpq;
+      message.setTimeStamp(std::round(ppq * ticksPerQuarter));
+      sequence.addEvent(message);
+    }
+    playHead.ppq = blockEnd;
+    samples += numSamples;
+  }
+  std::chrono::duration<double> renderTime =
+      std::chrono::steady_clock::now() - renderStarted;
+  AudioStats::Snapshot stats = processor.readAudioStats().since(statsBefore);
+  processor.releaseResources();
+
+  // Write the render with the host's tempo and meter
+  juce::MidiMessageSequence track;
+  track.addEvent(juce::MidiMessage::tempoMetaEvent(
+      static_cast<int>(std::round(60000000.0 / options.bpm))));
+  track.addEvent(juce::MidiMessage::timeSignatureMetaEvent(
+      options.numerator, options.denominator));
+  track.addSequence(sequence, 0.0);
+  track.updateMatchedPairs();
+  juce::MidiFile file;
+  file.setTicksPerQuarterNote(ticksPerQuarter);
+  file.addTrack(track);
+  juce::File outFile =
+      juce::File::getCurrentWorkingDirectory().getChildFile(options.out);
+  outFile.deleteFile();
+  juce::FileOutputStream stream(outFile);
+  if (!stream.openedOk() || !file.writeTo(stream)) {
+    std::printf("can't write %s\n", options.out.c_str());
+    return 1;
+  }
+
+  std::sort(blockTimes.begin(), blockTimes.end());
+  auto percentile = [&](double p) {
+    return blockTimes[static_cast<size_t>(p * (blockTimes.size() - 1))];
+  };
+  double audioSeconds = samples / options.sampleRate;
+  std::printf("%zu blocks, %.1f s of audio rendered in %.3f s (%.0fx real "
+              "time)\n",
+              blockTimes.size(), audioSeconds, renderTime.count(),
+              audioSeconds / renderTime.count());
+  std::printf("processBlock us: median %.2f, p99 %.2f, max %.2f\n",
+              percentile(0.5), percentile(0.99), blockTimes.back());
+  std::printf("load: average %.4f%%, worst %.4f%%, overruns %llu\n",
+              stats.averageLoad() * 100.0, stats.peakLoad * 100.0,
+              static_cast<unsigned long long>(stats.overruns));
+  std::printf("%d MIDI events (%llu counted by the processor), %u per block "
+              "at most, written to %s\n",
+              sequence.getNumEvents(),
+              static_cast<unsigned long long>(stats.events),
+              static_cast<unsigned>(stats.maxEvents), options.out.c_str());
+  return 0;
+}
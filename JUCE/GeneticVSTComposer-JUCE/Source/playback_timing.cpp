@@ -0,0 +1,141 @@
+// CMakeLists.txt target playback_timing, or by hand:
+// clang++ playback_timing.cpp melody_player.cpp -std=c++17 -O2 && ./a.out
+//
+// Plays melodies through MelodyPlayer and PlaybackClock against a simulated
+// host (random block sizes, tempo changes, loops, transport stops) and
+// measures how far every note-on is from its exact position on the host's
+// timeline, in samples.
+
+#include "melody_player.hpp"
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+struct Scenario {
+  const char *name;
+  bool tempoChanges;
+  bool hostLoop;  // the host jumps from loopEnd back to loopStart
+  bool stopStart; // the transport stops now and then (free-running clock)
+};
+
+struct Result {
+  long notes = 0;
+  double maxJitter = 0.0; // samples
+  long overlaps = 0;      // note-ons while a note was sounding
+};
+
+const double SAMPLE_RATE = 48000.0;
+const double STEP = 0.25; // sixteenth notes
+const double LOOP_START = 4.0;
+const double LOOP_END = 20.0;
+
+Result run(const Scenario &scenario, std::mt19937 &rng) {
+  std::vector<int> melody;
+  for (int i = 0; i < 32; ++i) {
+    int kind = rng() % 6;
+    melody.push_back(kind == 0 ? -1 : kind == 1 ? -2 : 48 + rng() % 24);
+  }
+  melody[0] = 60;
+  MelodySchedule schedule = MelodySchedule::compile(melody, STEP);
+
+  MelodyPlayer player;
+  player.prepare(static_cast<int>(melody.size()));
+  PlaybackClock clock;
+
+  PlaybackClock::HostPosition host;
+  host.valid = true;
+  host.playing = true;
+  host.bpm = 123.0;
+  double hostPpq = 0.0;
+  bool started = false;
+  double origin = 0.0;
+  bool sounding = false;
+  Result result;
+
+  for (int block = 0; block < 20000; ++block) {
+    int numSamples = 16 << (rng() % 9); // 16 - 4096
+    if (scenario.tempoChanges && rng() % 8 == 0)
+      host.bpm = 60.0 + (rng() % 12000) / 100.0;
+    if (scenario.stopStart && rng() % 200 == 0)
+      host.playing = !host.playing;
+    host.ppq = hostPpq;
+    host.barStart = std::floor(hostPpq / 4.0) * 4.0;
+
+    PlaybackClock::Change change = clock.advance(host, numSamples, SAMPLE_RATE);
+    auto noteOff = [&](int, int) { sounding = false; };
+    if (change == PlaybackClock::JUMP) {
+      player.flush(0, noteOff);
+      player.seek(clock.position());
+    } else if (change == PlaybackClock::RETIMED) {
+      player.rebase(clock.offset());
+      origin += clock.offset();
+    }
+
+    if (!started && block == 3) {
+      origin = clock.quantize(clock.position() + 100 / clock.samplesPerPpq(),
+                              PlaybackClock::BAR);
+      player.start(schedule, origin);
+      started = true;
+    }
+
+    double blockStart = clock.position();
+    double samplesPerPpq = clock.samplesPerPpq();
+    player.render(
+        blockStart, samplesPerPpq, numSamples,
+        [&](int sample, int pitch) {
+          // distance of the note-on from the melody's grid, in samples
+          double ppq = blockStart + sample / samplesPerPpq;
+          double steps = (ppq - origin) / STEP;
+          double jitter = (steps - std::round(steps)) * STEP * samplesPerPpq;
+          result.maxJitter = std::max(result.maxJitter, std::abs(jitter));
+          result.notes++;
+          if (sounding)
+            result.overlaps++;
+          sounding = true;
+          return pitch;
+        },
+        noteOff);
+
+    if (host.playing) {
+      hostPpq += numSamples / samplesPerPpq;
+      if (scenario.hostLoop && hostPpq >= LOOP_END)
+        hostPpq -= LOOP_END - LOOP_START;
+    }
+  }
+  return result;
+}
+
+int main() {
+  const Scenario scenarios[] = {
+      {"constant tempo", false, false, false},
+      {"tempo changes", true, false, false},
+      {"host loop", false, true, false},
+      {"tempo changes and loop", true, true, false},
+      {"transport stops", true, false, true},
+  };
+  std::mt19937 rng(2024);
+  bool ok = true;
+  for (const Scenario &scenario : scenarios) {
+    Result worst;
+    for (int melody = 0; melody < 20; ++melody) {
+      Result result = run(scenario, rng);
+      worst.notes += result.notes;
+      worst.overlaps += result.overlaps;
+      worst.maxJitter = std::max(worst.maxJitter, result.maxJitter);
+    }
+    bool passed = worst.maxJitter < 1.0 && worst.overlaps == 0;
+    ok = ok && passed;
+    std::printf("%-24s notes %8ld  max jitter %.4f samples  overlaps %ld  %s\n",
+                scenario.name, worst.notes, worst.maxJitter, worst.overlaps,
+                passed ? "ok" : "FAILED");
+  }
+
+  // For comparison: whole samples per step, as before, drift against the
+  // host grid by the truncated fraction on every step
+  double samplesPerStep = SAMPLE_RATE * 60.0 / 123.0 * STEP;
+  double steps = 10 * 60 * 123.0 / 60.0 / STEP; // ten minutes
+  std::printf("truncated step length drifts %.0f samples in ten minutes\n",
+              (samplesPerStep - std::floor(samplesPerStep)) * steps);
+  return ok ? 0 : 1;
+}
@@ -1,25 +1,22 @@
+import csv
 import matplotlib.pyplot as plt
 import os
 
 if __name__ == "__main__":
     os.makedirs("./graphs", exist_ok=True)
-    file_name = "fitness_512.txt"
+    # Telemetry CSV written by test.cpp (GeneticMelodyGenerator::test) in the
+    # directory it runs in. The ./fitness/*.txt samples use the older
+    # space-separated format and can't be read here.
+    file_name = "fitness_low_diversity.csv"
     base_file_name = os.path.splitext(file_name)[0]  # Get the base filename without extension
-    with open('./fitness/' + file_name, 'r') as file:
-        lines = file.readlines()
+    with open(file_name, 'r', newline='') as file:
+        rows = list(csv.DictReader(file))
 
     # Parse data
-    generations = []
-    avg_fitness = []
-    min_fitness = []
-    max_fitness = []
-
-    for line in lines[1:]:  # Skip the header
-        data = line.split()
-        generations.append(int(data[0]))
-        avg_fitness.append(float(data[1]))
-        min_fitness.append(float(data[2]))
-        max_fitness.append(float(data[3]))
+    generations = [int(row['generation']) for row in rows]
+    avg_fitness = [float(row['average_fitness']) for row in rows]
+    min_fitness = [float(row['min_fitness']) for row in rows]
+    max_fitness = [float(row['max_fitness']) for row in rows]
 
     # Plot
     plt.figure(figsize=(10, 6))
@@ -33,7 +30,7 @@ if __name__ == "__main__":
     # Add labels and title
     plt.xlabel('Generation')
     plt.ylabel('Fitness')
-    plt.title('Fitness Change Over Generations\nfor population size = 512')
+    plt.title('Fitness Change Over Generations')
     plt.legend()
 
     # Show plot
@@ -0,0 +1,99 @@
+#include "preset_calibration.hpp"
+#include <algorithm>
+#include <chrono>
+
+const std::vector<int> PresetCalibration::POPULATIONS = {32,  64,  128,
+                                                         256, 512, 1024};
+
+PresetCalibration::Sample
+PresetCalibration::measure(GeneticMelodyGenerator::Parameters params,
+                           const Preset &preset, float measures,
+                           uint32_t seed, const Setup &setup) {
+  params.populationSize = preset.populationSize;
+  params.numGenerations = preset.numGenerations;
+  Sample sample{preset, seed, 0.0, 0.0f, 0.0f};
+
+  auto started = std::chrono::steady_clock::now();
+  GeneticMelodyGenerator generator(params);
+  generator.set_seed(seed);
+  if (setup)
+    setup(generator);
+  // the last report is the final population
+  generator.set_progress_callback(
+      [&sample](const GeneticMelodyGenerator::Progress &progress) {
+        sample.bestFitness = progress.bestFitness;
+        sample.averageFitness = progress.averageFitness;
+      });
+  generator.run(measures);
+  sample.seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - started)
+                       .count();
+  return sample;
+}
+
+std::vector<PresetCalibration::Sample>
+PresetCalibration::paretoFrontier(std::vector<Sample> samples) {
+  std::sort(samples.begin(), samples.end(),
+            [](const Sample &a, const Sample &b) {
+              return a.seconds < b.seconds ||
+                     (a.seconds == b.seconds && a.bestFitness > b.bestFitness);
+            });
+  // Going from the fastest, a sample is on the frontier when it is better
+  // than every faster one
+  std::vector<Sample> frontier;
+  for (const Sample &sample : samples) {
+    if (frontier.empty() || sample.bestFitness > frontier.back().bestFitness)
+      frontier.push_back(sample);
+  }
+  return frontier;
+}
+
+std::vector<PresetCalibration::Preset>
+PresetCalibration::calibrate(const GeneticMelodyGenerator::Parameters &params,
+                             float measures,
+                             const std::vector<double> &targets,
+                             const Setup &setup,
+                             const std::function<bool()> &shouldStop) {
+  // Time of a run is fixed + generations * perGeneration, per population
+  struct Cost {
+    int populationSize;
+    double fixed;
+    double perGeneration;
+  };
+  const int SHORT_RUN = 4;
+  const int LONG_RUN = 16;
+  double longestTarget = targets.empty() ? 0.0 : targets.back();
+  std::vector<Cost> costs;
+  for (int population : POPULATIONS) {
+    if (shouldStop && shouldStop())
+      return {};
+    double shortRun =
+        measure(params, {population, SHORT_RUN}, measures, 1, setup).seconds;
+    double longRun =
+        measure(params, {population, LONG_RUN}, measures, 1, setup).seconds;
+    double perGeneration =
+        std::max(longRun - shortRun, 0.0) / (LONG_RUN - SHORT_RUN);
+    double fixed = std::max(shortRun - SHORT_RUN * perGeneration, 0.0);
+    costs.push_back({population, fixed, perGeneration});
+    // larger populations only get slower
+    if (longRun > longestTarget)
+      break;
+  }
+
+  std::vector<Preset> presets;
+  for (double target : targets) {
+    Preset preset{costs.front().populationSize, MIN_GENERATIONS};
+    for (const Cost &cost : costs) {
+      double budget = target - cost.fixed;
+      int generations =
+          cost.perGeneration > 0.0
+              ? static_cast<int>(budget / cost.perGeneration)
+              : MIN_GENERATIONS;
+      if (generations < MIN_GENERATIONS)
+        break;
+      preset = {cost.populationSize, std::min(generations, MAX_GENERATIONS)};
+    }
+    presets.push_back(preset);
+  }
+  return presets;
+}
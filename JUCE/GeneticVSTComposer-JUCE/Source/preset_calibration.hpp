@@ -0,0 +1,56 @@
+#ifndef PRESET_CALIBRATION_HPP
+#define PRESET_CALIBRATION_HPP
+
+#include "genetic.hpp"
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Trade-off between the time of a run and the fitness it reaches, and the
+// speed/quality presets derived from it on the machine at hand
+class PresetCalibration {
+public:
+  struct Preset {
+    int populationSize;
+    int numGenerations;
+  };
+
+  // One timed run
+  struct Sample {
+    Preset preset;
+    uint32_t seed;
+    double seconds;
+    float bestFitness;
+    float averageFitness; // of the final population
+  };
+
+  // Applies the caller's options (local search, repair, ...) to a generator
+  // before it runs
+  using Setup = std::function<void(GeneticMelodyGenerator &)>;
+
+  // Runs a generator with params and preset, from a fixed seed
+  static Sample measure(GeneticMelodyGenerator::Parameters params,
+                        const Preset &preset, float measures, uint32_t seed,
+                        const Setup &setup = nullptr);
+
+  // The samples that no other sample beats in both time and best fitness,
+  // fastest first
+  static std::vector<Sample> paretoFrontier(std::vector<Sample> samples);
+
+  // Presets for the latency targets (seconds, ascending). Short runs of
+  // every candidate population give its time per generation; each target
+  // gets the largest population that still affords MIN_GENERATIONS, with all
+  // the generations the target allows. (At the same time, a larger
+  // population reaches a better fitness than more generations, see
+  // benchmark.cpp --pareto.) Returns no presets when stopped.
+  static std::vector<Preset>
+  calibrate(const GeneticMelodyGenerator::Parameters &params, float measures,
+            const std::vector<double> &targets, const Setup &setup = nullptr,
+            const std::function<bool()> &shouldStop = nullptr);
+
+  static const std::vector<int> POPULATIONS;
+  static const int MIN_GENERATIONS = 10;
+  static const int MAX_GENERATIONS = 400; // the fitness doesn't improve after
+};
+
+#endif // PRESET_CALIBRATION_HPP
@@ -0,0 +1,158 @@
+#ifndef SCALE_TABLE_HPP
+#define SCALE_TABLE_HPP
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+
+// Scales as pitch-class sets. This is the integer counterpart of the mingus
+// Scales classes: no strings, no allocations, usable in constant expressions.
+namespace ScaleTable {
+
+// Scale types known to NotesGenerator, in the order of their names (the order
+// in which a partial name is matched)
+enum ScaleType {
+  AEOLIAN,
+  CHROMATIC,
+  DORIAN,
+  HARMONIC_MINOR,
+  IONIAN,
+  LOCRIAN,
+  LYDIAN,
+  MAJOR,
+  MELODIC_MINOR,
+  MIXOLYDIAN,
+  NATURAL_MINOR,
+  OCTATONIC,
+  PHRYGIAN,
+  WHOLE_TONE,
+  SCALE_TYPE_COUNT
+};
+
+struct ScaleInfo {
+  const char *name;
+  int size;
+  std::array<int, 12> intervals; // semitones above the tonic, ascending
+  uint16_t mask;                 // bit n for pitch class n, tonic on C
+};
+
+constexpr uint16_t intervalMask(const std::array<int, 12> &intervals,
+                                int size) {
+  uint16_t mask = 0;
+  for (int i = 0; i < size; ++i)
+    mask |= 1 << intervals[i];
+  return mask;
+}
+
+constexpr ScaleInfo makeScale(const char *name, int size,
+                              const std::array<int, 12> &intervals) {
+  return {name, size, intervals, intervalMask(intervals, size)};
+}
+
+constexpr std::array<ScaleInfo, SCALE_TYPE_COUNT> SCALES = {{
+    makeScale("Aeolian", 7, {0, 2, 3, 5, 7, 8, 10}),
+    makeScale("Chromatic", 12, {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11}),
+    makeScale("Dorian", 7, {0, 2, 3, 5, 7, 9, 10}),
+    makeScale("Harmonic Minor", 7, {0, 2, 3, 5, 7, 8, 11}),
+    makeScale("Ionian", 7, {0, 2, 4, 5, 7, 9, 11}),
+    makeScale("Locrian", 7, {0, 1, 3, 5, 6, 8, 10}),
+    makeScale("Lydian", 7, {0, 2, 4, 6, 7, 9, 11}),
+    makeScale("Major", 7, {0, 2, 4, 5, 7, 9, 11}),
+    makeScale("Melodic Minor", 7, {0, 2, 3, 5, 7, 9, 11}),
+    makeScale("Mixolydian", 7, {0, 2, 4, 5, 7, 9, 10}),
+    makeScale("Natural Minor", 7, {0, 2, 3, 5, 7, 8, 10}),
+    makeScale("Octatonic", 8, {0, 2, 3, 5, 6, 8, 9, 11}),
+    makeScale("Phrygian", 7, {0, 1, 3, 5, 7, 8, 10}),
+    makeScale("Whole Tone", 6, {0, 2, 4, 6, 8, 10}),
+}};
+
+static_assert(SCALES[MAJOR].mask == 0xAB5, "C major is C D E F G A B");
+static_assert(SCALES[CHROMATIC].mask == 0xFFF, "all twelve pitch classes");
+
+// Perfect hash of the scale names: every name has its own slot
+constexpr int NAME_SLOT_COUNT = 32;
+constexpr int nameHash(std::string_view name) {
+  if (name.size() < 2)
+    return 0;
+  unsigned first = static_cast<unsigned char>(name[0]);
+  unsigned second = static_cast<unsigned char>(name[1]);
+  return static_cast<int>((first + 3 * second + 5 * name.size()) %
+                          NAME_SLOT_COUNT);
+}
+
+constexpr std::array<int, NAME_SLOT_COUNT> makeNameSlots() {
+  std::array<int, NAME_SLOT_COUNT> slots{};
+  for (int &slot : slots)
+    slot = -1;
+  for (int type = 0; type < SCALE_TYPE_COUNT; ++type)
+    slots[nameHash(SCALES[type].name)] = type;
+  return slots;
+}
+constexpr std::array<int, NAME_SLOT_COUNT> NAME_SLOTS = makeNameSlots();
+
+constexpr bool isPerfectHash() {
+  for (int type = 0; type < SCALE_TYPE_COUNT; ++type) {
+    if (NAME_SLOTS[nameHash(SCALES[type].name)] != type)
+      return false;
+  }
+  return true;
+}
+static_assert(isPerfectHash(), "scale names collide in NAME_SLOTS");
+
+// Exact lookup of a scale type name ("Harmonic Minor")
+constexpr bool findScaleType(std::string_view name, ScaleType &type) {
+  int slot = NAME_SLOTS[nameHash(name)];
+  if (slot < 0 || name != SCALES[slot].name)
+    return false;
+  type = static_cast<ScaleType>(slot);
+  return true;
+}
+
+// A scale type on a tonic pitch class (0-11)
+struct Key {
+  int tonic;
+  ScaleType type;
+};
+
+// Interned handle of a key, small enough to index per-key tables
+using ScaleId = uint8_t;
+constexpr int SCALE_ID_COUNT = 12 * SCALE_TYPE_COUNT;
+constexpr ScaleId scaleId(const Key &key) {
+  return static_cast<ScaleId>(key.tonic * SCALE_TYPE_COUNT + key.type);
+}
+constexpr Key keyOf(ScaleId id) {
+  return {id / SCALE_TYPE_COUNT, static_cast<ScaleType>(id % SCALE_TYPE_COUNT)};
+}
+
+struct PitchClasses {
+  int size;
+  std::array<int, 12> notes;
+};
+
+// Pitch classes of the scale, ascending from the tonic
+constexpr PitchClasses pitchClasses(const Key &key) {
+  const ScaleInfo &scale = SCALES[key.type];
+  PitchClasses result{scale.size, {}};
+  for (int i = 0; i < scale.size; ++i)
+    result.notes[i] = (key.tonic + scale.intervals[i]) % 12;
+  return result;
+}
+
+// Bit n is set when pitch class n belongs to the scale
+constexpr uint16_t pitchClassMask(const Key &key) {
+  uint32_t mask = uint32_t(SCALES[key.type].mask) << key.tonic;
+  return static_cast<uint16_t>((mask | (mask >> 12)) & 0xFFF);
+}
+
+static_assert(pitchClassMask({9, NATURAL_MINOR}) == SCALES[MAJOR].mask,
+              "A minor has the pitch classes of C major");
+
+// Pitch class of a natural note letter (A-G)
+constexpr int letterPitchClass(char letter) {
+  constexpr int pitch_classes[] = {9, 11, 0, 2, 4, 5, 7};
+  return pitch_classes[letter - 'A'];
+}
+
+} // namespace ScaleTable
+
+#endif // SCALE_TABLE_HPP
@@ -0,0 +1,55 @@
+#include "telemetry.hpp"
+#include <algorithm>
+#include <utility>
+
+CsvTelemetrySink::CsvTelemetrySink(std::ostream &out) : out(out) {
+  out << "generation,generations,min_fitness,average_fitness,max_fitness,"
+         "diversity,duplicate_rate,evaluations,elapsed_seconds\n";
+}
+
+void CsvTelemetrySink::record(const GenerationStats &stats) {
+  out << stats.generation << ',' << stats.generations << ','
+      << stats.minFitness << ',' << stats.averageFitness << ','
+      << stats.maxFitness << ',' << stats.diversity << ','
+      << stats.duplicateRate << ',' << stats.evaluations << ','
+      << stats.elapsedSeconds << '\n';
+}
+
+RingBufferTelemetrySink::RingBufferTelemetrySink(size_t capacity)
+    : buffer(std::max<size_t>(capacity, 1)) {}
+
+void RingBufferTelemetrySink::record(const GenerationStats &stats) {
+  buffer[written % buffer.size()] = stats;
+  written++;
+}
+
+size_t RingBufferTelemetrySink::size() const {
+  return static_cast<size_t>(std::min<uint64_t>(written, buffer.size()));
+}
+
+uint64_t RingBufferTelemetrySink::dropped() const {
+  return written - size();
+}
+
+std::vector<GenerationStats> RingBufferTelemetrySink::records() const {
+  std::vector<GenerationStats> ordered;
+  ordered.reserve(size());
+  for (uint64_t i = written - size(); i < written; ++i)
+    ordered.push_back(buffer[i % buffer.size()]);
+  return ordered;
+}
+
+void RingBufferTelemetrySink::writeBinary(std::ostream &out) const {
+  for (const GenerationStats &stats : records())
+    out.write(reinterpret_cast<const char *>(&stats), sizeof(stats));
+}
+
+void RingBufferTelemetrySink::clear() { written = 0; }
+
+CallbackTelemetrySink::CallbackTelemetrySink(Callback callback)
+    : callback(std::move(callback)) {}
+
+void CallbackTelemetrySink::record(const GenerationStats &stats) {
+  if (callback)
+    callback(stats);
+}
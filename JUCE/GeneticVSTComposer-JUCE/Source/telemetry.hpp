@@ -0,0 +1,77 @@
+#ifndef TELEMETRY_HPP
+#define TELEMETRY_HPP
+
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <vector>
+
+// Statistics of one generation of GeneticMelodyGenerator::run(), taken from
+// the scores it already computed (nothing is rescored)
+struct GenerationStats {
+  int32_t generation; // 0 for the initial population
+  int32_t generations;
+  float minFitness;
+  float averageFitness;
+  float maxFitness;
+  float diversity;     // 1 - average similarity to the rest of the population
+  float duplicateRate; // share of melodies identical to an earlier one
+  int64_t evaluations; // melodies scored since the run started
+  double elapsedSeconds;
+};
+
+// Receives the statistics on the thread running the generator, once per
+// generation. run() computes them only when a sink is set.
+class TelemetrySink {
+public:
+  virtual ~TelemetrySink() = default;
+  virtual void record(const GenerationStats &stats) = 0;
+};
+
+// Discards everything
+class NullTelemetrySink : public TelemetrySink {
+public:
+  void record(const GenerationStats &) override {}
+};
+
+// One line per generation, with a header
+class CsvTelemetrySink : public TelemetrySink {
+public:
+  explicit CsvTelemetrySink(std::ostream &out);
+  void record(const GenerationStats &stats) override;
+
+private:
+  std::ostream &out;
+};
+
+// The last `capacity` generations in a preallocated buffer; recording never
+// allocates. Read it on the generator's thread, or after the run.
+class RingBufferTelemetrySink : public TelemetrySink {
+public:
+  explicit RingBufferTelemetrySink(size_t capacity);
+  void record(const GenerationStats &stats) override;
+
+  size_t size() const;
+  uint64_t dropped() const; // overwritten records
+  std::vector<GenerationStats> records() const; // oldest first
+  // The records as raw GenerationStats (native byte order), oldest first
+  void writeBinary(std::ostream &out) const;
+  void clear();
+
+private:
+  std::vector<GenerationStats> buffer;
+  uint64_t written = 0;
+};
+
+// Forwards to a function, e.g. to update a live view
+class CallbackTelemetrySink : public TelemetrySink {
+public:
+  using Callback = std::function<void(const GenerationStats &)>;
+  explicit CallbackTelemetrySink(Callback callback);
+  void record(const GenerationStats &stats) override;
+
+private:
+  Callback callback;
+};
+
+#endif // TELEMETRY_HPP
@@ -1,4 +1,6 @@
-// clang++ test.cpp genetic.cpp mingus.cpp notes_generator.cpp  -std=c++11 && ./a.out
+// CMakeLists.txt target genetic_test, or by hand:
+// clang++ test.cpp genetic.cpp mingus.cpp notes_generator.cpp telemetry.cpp
+//   trace.cpp worker_pool.cpp -std=c++17 -pthread && ./a.out
 
 #include "genetic.hpp"
 #include "mingus.hpp"
@@ -39,7 +41,10 @@ int main() {
       valence, jazziness, weirdness, meter, fundNoteDuration, populationSize,
       numGenerations);
 
-  generator.test(1, "fitness_low_diversity.txt");
+  if (!generator.test(1, "fitness_low_diversity.csv")) {
+    std::cout << "Can't write fitness_low_diversity.csv" << std::endl;
+    return 1;
+  }
 
   return 0;
 }
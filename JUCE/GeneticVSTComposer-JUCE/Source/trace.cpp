@@ -0,0 +1,183 @@
+#include "trace.hpp"
+
+#ifdef GENETIC_TRACE
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Trace {
+
+namespace {
+
+// A slot is published by storing its name last; null means not written yet
+struct Event {
+  std::atomic<const char *> name{nullptr};
+  uint64_t begin; // ns
+  uint64_t duration;
+  uint32_t thread;
+};
+
+// Static, so that recording never allocates
+Event events[CAPACITY];
+// Capture number in the high half, slots taken in the low half, so that a
+// span begun in an earlier capture can't take a slot of the current one
+std::atomic<uint64_t> reserved{0};
+// Spans between taking a slot and publishing it
+std::atomic<uint32_t> writers{0};
+std::atomic<bool> capturing{false};
+std::atomic<uint64_t> captureStart{0};
+// Keeps start() from reusing the slots write() is reading
+std::mutex captureLock;
+
+uint32_t captureOf(uint64_t reservation) {
+  return static_cast<uint32_t>(reservation >> 32);
+}
+
+uint64_t slotsOf(uint64_t reservation) { return reservation & 0xffffffffu; }
+
+// Threads are numbered in the order of their first span
+std::atomic<uint32_t> nextThread{1};
+thread_local uint32_t threadId = 0;
+
+std::mutex threadNamesLock;
+std::vector<std::pair<uint32_t, std::string>> threadNames;
+
+uint64_t now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+uint32_t currentThread() {
+  if (threadId == 0)
+    threadId = nextThread++;
+  return threadId;
+}
+
+void writeString(std::ostream &out, const std::string &text) {
+  out << '"';
+  for (char c : text) {
+    if (c == '"' || c == '\\')
+      out << '\\';
+    out << c;
+  }
+  out << '"';
+}
+
+} // namespace
+
+void start() {
+  const std::lock_guard<std::mutex> lock(captureLock);
+  capturing = false;
+  uint64_t previous = reserved.load();
+  reserved = uint64_t(captureOf(previous) + 1) << 32;
+  // Spans of the previous capture that already took a slot finish writing it
+  while (writers.load() != 0)
+    std::this_thread::yield();
+  size_t count =
+      static_cast<size_t>(std::min<uint64_t>(slotsOf(previous), CAPACITY));
+  for (size_t i = 0; i < count; ++i)
+    events[i].name.store(nullptr, std::memory_order_relaxed);
+  captureStart = now();
+  capturing = true;
+}
+
+void stop() { capturing = false; }
+
+bool running() { return capturing; }
+
+uint64_t dropped() {
+  uint64_t count = slotsOf(reserved);
+  return count > CAPACITY ? count - CAPACITY : 0;
+}
+
+void setThreadName(const char *name) {
+  uint32_t thread = currentThread();
+  const std::lock_guard<std::mutex> lock(threadNamesLock);
+  for (auto &threadName : threadNames) {
+    if (threadName.first == thread) {
+      threadName.second = name;
+      return;
+    }
+  }
+  threadNames.emplace_back(thread, name);
+}
+
+size_t write(std::ostream &out) {
+  const std::lock_guard<std::mutex> captureGuard(captureLock);
+  size_t count = static_cast<size_t>(
+      std::min<uint64_t>(slotsOf(reserved), CAPACITY));
+  uint64_t origin = captureStart;
+  // Timestamps in microseconds from the start of the capture
+  auto microseconds = [origin](uint64_t ns) {
+    return (static_cast<double>(ns) - static_cast<double>(origin)) / 1000.0;
+  };
+
+  const std::ios::fmtflags flags = out.flags();
+  const std::streamsize precision = out.precision();
+  out << std::fixed << std::setprecision(3);
+  out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+  bool first = true;
+  {
+    const std::lock_guard<std::mutex> lock(threadNamesLock);
+    for (const auto &threadName : threadNames) {
+      out << (first ? "\n" : ",\n")
+          << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+             "\"tid\": "
+          << threadName.first << ", \"args\": {\"name\": ";
+      writeString(out, threadName.second);
+      out << "}}";
+      first = false;
+    }
+  }
+  size_t written = 0;
+  for (size_t i = 0; i < count; ++i) {
+    const Event &event = events[i];
+    // Skips slots still being written and spans begun before start()
+    const char *name = event.name.load(std::memory_order_acquire);
+    if (name == nullptr || event.begin < origin)
+      continue;
+    out << (first ? "\n" : ",\n") << "{\"name\": ";
+    writeString(out, name);
+    out << ", \"ph\": \"X\", \"pid\": 1, \"tid\": " << event.thread
+        << ", \"ts\": " << microseconds(event.begin)
+        << ", \"dur\": " << event.duration / 1000.0 << "}";
+    first = false;
+    written++;
+  }
+  out << "\n]}\n";
+  out.flags(flags);
+  out.precision(precision);
+  return written;
+}
+
+Span::Span(const char *name)
+    : name(name), begin(capturing.load(std::memory_order_relaxed) ? now() : 0),
+      capture(captureOf(reserved)) {}
+
+Span::~Span() {
+  if (begin == 0)
+    return;
+  uint64_t end = now();
+  writers++;
+  uint64_t reservation = reserved++;
+  uint64_t index = slotsOf(reservation);
+  if (captureOf(reservation) == capture && index < CAPACITY) {
+    Event &event = events[index];
+    event.begin = begin;
+    event.duration = end - begin;
+    event.thread = currentThread();
+    event.name.store(name, std::memory_order_release);
+  }
+  writers--;
+}
+
+} // namespace Trace
+
+#endif // GENETIC_TRACE
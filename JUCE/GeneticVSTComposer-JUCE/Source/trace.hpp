@@ -0,0 +1,84 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+// Scoped spans of the generator and the processor, written as Chrome trace
+// JSON (ui.perfetto.dev, chrome://tracing) with the thread every span ran on.
+// With GENETIC_TRACE defined, TRACE_SCOPE("name") records the time until the
+// end of the scope and TRACE_CALL(function, arguments...) the time of the
+// call under the function's name, while a capture is running. Otherwise the
+// macros compile to nothing and the functions below do nothing.
+//
+//   Trace::start(); ... Trace::stop(); Trace::write(file);
+//
+// Names must be string literals: only the pointer is stored. Recording takes
+// two clock reads and a few atomic operations, without locks or allocations,
+// so spans are allowed on the audio thread. Events beyond CAPACITY are
+// dropped.
+namespace Trace {
+
+#ifdef GENETIC_TRACE
+
+constexpr bool ENABLED = true;
+constexpr size_t CAPACITY = size_t(1) << 20;
+
+// Starts a new capture, dropping the events of the previous one
+void start();
+void stop();
+bool running();
+// Writes the events of the last capture and returns their number. Call it
+// after stop(); spans still ending meanwhile may be left out, and a start()
+// on another thread waits until the writing is done.
+size_t write(std::ostream &out);
+uint64_t dropped();
+// Shown in the viewer for the calling thread
+void setThreadName(const char *name);
+
+class Span {
+public:
+  explicit Span(const char *name);
+  ~Span();
+  Span(const Span &) = delete;
+  Span &operator=(const Span &) = delete;
+
+private:
+  const char *name;
+  uint64_t begin;   // 0 outside of a capture
+  uint32_t capture; // the capture the span began in
+};
+
+template <typename Call> auto measure(const char *name, Call &&call) {
+  const Span span(name);
+  return call();
+}
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name)                                                      \
+  const ::Trace::Span TRACE_CONCAT(traceSpan, __LINE__)(name)
+#define TRACE_CALL(function, ...)                                              \
+  ::Trace::measure(#function, [&] { return function(__VA_ARGS__); })
+
+#else
+
+constexpr bool ENABLED = false;
+constexpr size_t CAPACITY = 0;
+
+inline void start() {}
+inline void stop() {}
+inline bool running() { return false; }
+inline size_t write(std::ostream &) { return 0; }
+inline uint64_t dropped() { return 0; }
+inline void setThreadName(const char *) {}
+
+#define TRACE_SCOPE(name) ((void)0)
+#define TRACE_CALL(function, ...) function(__VA_ARGS__)
+
+#endif
+
+} // namespace Trace
+
+#endif // TRACE_HPP
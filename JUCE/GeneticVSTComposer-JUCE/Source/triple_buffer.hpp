@@ -0,0 +1,50 @@
+#ifndef TRIPLE_BUFFER_HPP
+#define TRIPLE_BUFFER_HPP
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Wait-free hand-off of values from one writer thread to one reader thread.
+// The writer fills the back buffer and publishes it, the reader adopts the
+// latest published one. Neither side waits or allocates, and the buffer the
+// reader holds is never written. Old values are overwritten by the writer,
+// so they are also released on the writer's thread.
+template <typename T> class TripleBuffer {
+public:
+  // Gives access to all three buffers, e.g. to reserve memory. Only before
+  // the buffer is shared between threads.
+  template <typename Function> void forEach(Function function) {
+    for (T &buffer : buffers)
+      function(buffer);
+  }
+
+  // Writer: fill write(), then publish() it
+  T &write() { return buffers[back]; }
+  void publish() {
+    back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX;
+  }
+
+  // Reader: adopts the latest published buffer, returns false if there is
+  // nothing new since the last update()
+  bool update() {
+    if ((middle.load(std::memory_order_relaxed) & FRESH) == 0)
+      return false;
+    front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+    return true;
+  }
+  const T &read() const { return buffers[front]; }
+
+private:
+  static constexpr uint8_t INDEX = 3;
+  static constexpr uint8_t FRESH = 4;
+  static_assert(std::atomic<uint8_t>::is_always_lock_free,
+                "the hand-off has to be lock-free");
+
+  std::array<T, 3> buffers{};
+  uint8_t front = 0;              // reader's buffer
+  std::atomic<uint8_t> middle{1}; // last published buffer and FRESH
+  uint8_t back = 2;               // writer's buffer
+};
+
+#endif // TRIPLE_BUFFER_HPP
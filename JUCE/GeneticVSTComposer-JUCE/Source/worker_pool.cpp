@@ -0,0 +1,51 @@
+#include "worker_pool.hpp"
+#include <algorithm>
+
+WorkerPool::WorkerPool(size_t count) {
+  count = std::max<size_t>(count, 1);
+  threads.reserve(count);
+  for (size_t i = 0; i < count; ++i)
+    threads.emplace_back([this, i] { work(i); });
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    const std::lock_guard<std::mutex> guard(lock);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (std::thread &thread : threads)
+    thread.join();
+}
+
+void WorkerPool::run(size_t count, const std::function<void(size_t)> &task) {
+  if (count == 0)
+    return;
+  std::unique_lock<std::mutex> guard(lock);
+  this->task = &task;
+  taskCount = count;
+  busy = threads.size();
+  round++;
+  wake.notify_all();
+  done.wait(guard, [this] { return busy == 0; });
+  this->task = nullptr;
+}
+
+void WorkerPool::work(size_t index) {
+  uint64_t seen = 0;
+  std::unique_lock<std::mutex> guard(lock);
+  while (true) {
+    wake.wait(guard, [&] { return stopping || round != seen; });
+    if (stopping)
+      return;
+    seen = round;
+    const std::function<void(size_t)> &current = *task;
+    size_t count = taskCount;
+    guard.unlock();
+    for (size_t i = index; i < count; i += threads.size())
+      current(i);
+    guard.lock();
+    if (--busy == 0)
+      done.notify_one();
+  }
+}
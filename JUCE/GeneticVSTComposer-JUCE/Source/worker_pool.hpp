@@ -0,0 +1,42 @@
+#ifndef WORKER_POOL_HPP
+#define WORKER_POOL_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Threads that live as long as the pool and run one parallel loop at a time,
+// so that repeated runs don't create and join threads
+class WorkerPool {
+public:
+  explicit WorkerPool(size_t count);
+  ~WorkerPool();
+  WorkerPool(const WorkerPool &) = delete;
+  WorkerPool &operator=(const WorkerPool &) = delete;
+
+  size_t size() const { return threads.size(); }
+
+  // Calls task(i) for every i < count, on worker i % size(), and returns
+  // when all calls have finished. With count <= size() all of them run at
+  // the same time.
+  void run(size_t count, const std::function<void(size_t)> &task);
+
+private:
+  void work(size_t index);
+
+  std::vector<std::thread> threads;
+  std::mutex lock;
+  std::condition_variable wake;
+  std::condition_variable done;
+  const std::function<void(size_t)> *task = nullptr;
+  size_t taskCount = 0;
+  uint64_t round = 0; // loops started so far
+  size_t busy = 0;    // workers still in the current loop
+  bool stopping = false;
+};
+
+#endif // WORKER_POOL_HPP